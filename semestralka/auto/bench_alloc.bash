@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Allocation benchmark: create many small files (spread over directories, one
+# per batch) and print how long each batch took per file.
+# With next-fit allocation the time per file should stay flat.
+# usage: ./auto/bench_alloc.bash [files=100000] [batch=1000] [zos options...]
+
+files=${1:-100000}
+batch=${2:-1000}
+shift $(($# < 2 ? $# : 2))
+
+script="tmp/bench_alloc.load"
+times="tmp/bench_alloc.times"
+
+mkdir -p tmp
+printf 'x' >tmp/bench_alloc.txt
+rm -f "$times"
+
+echo "Generating $files files in batches of $batch..."
+{
+    echo "format 600mb"
+    for ((i = 0; i < files; i++)); do
+        if ((i % batch == 0)); then
+            echo "exec date +%s%N >> $times"
+            echo "mkdir d$((i / batch))"
+        fi
+        echo "incp tmp/bench_alloc.txt d$((i / batch))/f$i"
+    done
+    echo "exec date +%s%N >> $times"
+} >"$script"
+
+echo "load $script" | ./bin/zos tmp/bench_alloc.voky -d ram "$@" >/dev/null 2>&1
+
+# nanoseconds between marks -> microseconds per file
+awk -v batch="$batch" '
+NR > 1 { printf "batch %4d: %8.1f us/file\n", NR - 2, ($1 - prev) / batch / 1000 }
+{ prev = $1 }' "$times"
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace jkfs {
+
+enum class Bit_Order {
+  LSB_FIRST,
+  MSB_FIRST,
+};
+
+// In-memory copy of an on-disk bitmap, stored as 64-bit words.
+// Bit i of the bitmap is bit (i % 64) of word (i / 64), the on-disk bit order
+// inside each byte is applied only on load() and byte().
+// Every change marks its word as dirty, so only changed parts are written
+// back.
+// Allocation is next-fit: searching resumes at a cursor after the last
+// allocation and wraps around to the lowest bit which was freed since, so
+// the used prefix isn't rescanned every time.
+class Bitmap {
+private:
+  Bit_Order order_;
+  std::vector<uint64_t> words_;
+  std::vector<uint64_t> dirty_; // one bit per word of words_
+  size_t bits_ = 0;             // how many bits are valid
+  size_t bytes_ = 0;            // size on disk, may hold padding bits
+  size_t cursor_ = 0;           // next-fit: where the next search starts
+  size_t low_water_ = 0;        // all bits below it are ones
+
+  void mark_dirty(size_t word_idx);
+  // apply <value> to bits [start, start + count)
+  void assign_range(size_t start, size_t count, bool value);
+
+public:
+  Bitmap(Bit_Order order);
+
+  // replace content with on-disk bytes, only first <bits> bits are used
+  // everything is clean afterwards
+  void load(std::span<const uint8_t> bytes, size_t bits);
+  // reset to <bits> zeros stored in <bytes> bytes, everything is clean
+  void reset(size_t bits, size_t bytes);
+
+  // how many bits are valid
+  size_t size() const;
+  bool get(size_t bit_idx) const;
+  void set(size_t bit_idx);
+  void clear(size_t bit_idx);
+  // set/clear bits [start, start + count), whole words at once
+  void set_range(size_t start, size_t count);
+  void clear_range(size_t start, size_t count);
+
+  // index of first bit equal to value at or after <from>, -1 if there is none
+  // skips whole words which cannot contain the value
+  int64_t find_first(bool value, size_t from = 0) const;
+  // index of first run of <count> zero bits at or after <hint>, wraps around
+  // to the beginning; -1 if there is none
+  int64_t find_run(size_t count, size_t hint = 0) const;
+  // index of first zero bit at or after the cursor, wraps around; -1 if there
+  // is none. Doesn't move the cursor.
+  int64_t find_next_free();
+  // where the next search starts, set it after allocating
+  size_t cursor() const;
+  void cursor(size_t bit_idx);
+  // all runs of zero bits as {start, length}, in order
+  std::vector<std::pair<size_t, size_t>> zero_runs() const;
+  // indexes of all set bits
+  std::vector<int32_t> ones() const;
+
+  // on-disk representation of one byte
+  uint8_t byte(size_t byte_idx) const;
+  // byte ranges [start, start + count) which changed since last clean()
+  std::vector<std::pair<size_t, size_t>> dirty_ranges() const;
+  // forget all changes
+  void clean();
+};
+
+} // namespace jkfs
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace jkfs {
+
+// Bounded in-memory copy of clusters keyed by cluster index.
+// Least recently used cluster is evicted first, dirty clusters are written
+// back (through the callback) on eviction or flush().
+class ClusterCache {
+public:
+  // called with cluster index & its content when dirty cluster leaves memory
+  using Write_Back = std::function<void(int32_t, const std::vector<uint8_t> &)>;
+
+private:
+  struct Entry {
+    std::vector<uint8_t> data;
+    bool dirty = false;
+    std::list<int32_t>::iterator lru_pos; // position in lru_
+  };
+
+  size_t capacity_;
+  // most recently used at the front
+  std::list<int32_t> lru_;
+  std::unordered_map<int32_t, Entry> entries_;
+  Write_Back write_back_;
+
+  // statistics
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+
+  // evict least recently used entries until at most <count> are left
+  void evict_until(size_t count);
+
+public:
+  ClusterCache(size_t capacity);
+
+  // capacity 0 disables the cache - nothing is ever stored
+  bool enabled() const;
+  size_t capacity() const;
+  // shrinking writes back evicted dirty clusters
+  void capacity(size_t capacity);
+  void write_back(Write_Back write_back);
+
+  // get cached content & mark it as recently used, nullptr if not cached
+  std::vector<uint8_t> *find(int32_t cluster_idx);
+  // if cluster is cached, doesn't count as use
+  bool contains(int32_t cluster_idx) const;
+  // insert or replace content, return the stored copy
+  // WARN: when disabled, nothing is stored and content is only written back
+  // if dirty
+  std::vector<uint8_t> *put(int32_t cluster_idx, std::vector<uint8_t> data,
+                            bool dirty);
+  // cached content was changed in place (through find), write it back later
+  void mark_dirty(int32_t cluster_idx);
+  // forget one cluster without writing it back
+  void erase(int32_t cluster_idx);
+
+  // write back all dirty clusters, keep them cached
+  void flush();
+  // forget everything without writing back
+  void clear();
+
+  size_t hits() const;
+  size_t misses() const;
+  size_t size() const;
+};
+
+} // namespace jkfs
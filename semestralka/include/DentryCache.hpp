@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace jkfs {
+
+// Bounded in-memory map of directory entries, (parent inode, name) -> child
+// inode. Child ABSENT remembers that the name isn't in the directory.
+// Least recently used entry is evicted first. Directory code keeps entries
+// up to date, so there is nothing to write back.
+class DentryCache {
+public:
+  // child of negative entry
+  static constexpr int32_t ABSENT = -1;
+
+private:
+  using Key = std::pair<int32_t, std::string>;
+
+  struct Key_Hash {
+    size_t operator()(const Key &key) const;
+  };
+
+  struct Entry {
+    int32_t child = ABSENT;
+    std::list<Key>::iterator lru_pos; // position in lru_
+  };
+
+  size_t capacity_;
+  // most recently used at the front
+  std::list<Key> lru_;
+  std::unordered_map<Key, Entry, Key_Hash> entries_;
+  // how many entries every parent has, so forgetting a directory without
+  // any entries doesn't walk the whole cache
+  std::unordered_map<int32_t, size_t> parents_;
+
+  // statistics
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+
+  // evict least recently used entries until at most <count> are left
+  void evict_until(size_t count);
+  // remove entry & its count in parents_
+  void remove(std::unordered_map<Key, Entry, Key_Hash>::iterator it);
+
+public:
+  DentryCache(size_t capacity);
+
+  // capacity 0 disables the cache - nothing is ever stored
+  bool enabled() const;
+  size_t capacity() const;
+  void capacity(size_t capacity);
+
+  // get cached child (or ABSENT) & mark it as recently used, nullopt if the
+  // name isn't cached
+  std::optional<int32_t> find(int32_t parent_id, const std::string &name);
+  // insert or replace entry
+  void put(int32_t parent_id, const std::string &name, int32_t child_id);
+  // forget one entry
+  void erase(int32_t parent_id, const std::string &name);
+  // forget all entries of one directory, e.g. when its inode is freed
+  void erase_parent(int32_t parent_id);
+  // forget everything
+  void clear();
+
+  size_t hits() const;
+  size_t misses() const;
+  size_t size() const;
+};
+
+} // namespace jkfs
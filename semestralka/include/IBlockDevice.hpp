@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "errors.hpp"
+
+namespace jkfs {
+
+// Storage on which the filesystem lives. Addressed by absolute byte offsets,
+// every implementation must throw on access outside of its size.
+class IBlockDevice {
+protected:
+  // throw if <count> bytes from <offset> don't fit inside the device
+  void check_bounds(size_t offset, size_t count) const {
+    if (offset + count < offset || offset + count > size()) {
+      throw jkfilesystem_error("Access outside of device " + name() + ": " +
+                               std::to_string(offset) + "+" +
+                               std::to_string(count) + " > " +
+                               std::to_string(size()));
+    }
+  }
+
+public:
+  virtual ~IBlockDevice() = default;
+
+  // copy <count> bytes from <offset> into <data>
+  virtual void read(size_t offset, void *data, size_t count) = 0;
+  // copy <count> bytes from <data> to <offset>
+  virtual void write(size_t offset, const void *data, size_t count) = 0;
+  // hand buffered writes over to the OS
+  virtual void flush() = 0;
+  // make all written data durable (fsync, msync, ...)
+  virtual void sync() = 0;
+  // change size of the storage, create it if it doesn't exist
+  // existing bytes are kept (up to new size), new bytes are zeros
+  virtual void resize(size_t size) = 0;
+  // current size in bytes, 0 if storage doesn't exist yet
+  virtual size_t size() const = 0;
+
+  // copy <count> bytes from <offset> into host file <fd> at <fd_offset>
+  // without passing through user space; return how many bytes were copied,
+  // 0 if device can't do it (the rest is up to caller)
+  virtual size_t copy_to_fd(size_t /*offset*/, int /*fd*/,
+                            size_t /*fd_offset*/, size_t /*count*/) {
+    return 0;
+  }
+  // the same as copy_to_fd, but from host file <fd> into the device
+  virtual size_t copy_from_fd(int /*fd*/, size_t /*fd_offset*/,
+                              size_t /*offset*/, size_t /*count*/) {
+    return 0;
+  }
+
+  // whole content of the device if it is addressable in memory, otherwise
+  // nullptr; pointer is valid until the next resize()
+  virtual uint8_t *data() { return nullptr; }
+  // human readable name, e.g. path to the file
+  virtual std::string name() const = 0;
+};
+
+} // namespace jkfs
@@ -50,6 +50,7 @@ public:
   void execute(const std::vector<std::string> &args) noexcept {
     try {
       execute_inner(args);
+      fs_.end_command();
       print_message(SUCCESS);
 
     } catch (std::exception &e) {
@@ -57,6 +58,15 @@ public:
         std::cout << "EXCEPTION HAPPENED:\n" << e.what() << std::endl;
       }
       print_message(FAILURE);
+
+      // even failed command may have changed something (e.g. rollback)
+      try {
+        fs_.end_command();
+      } catch (std::exception &e) {
+        if (fs_.vocal()) {
+          std::cout << "CANNOT FLUSH:\n" << e.what() << std::endl;
+        }
+      }
     }
   }
 
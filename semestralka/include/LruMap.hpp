@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace jkfs {
+
+// Map holding at most <capacity> values, the least recently used one is
+// evicted first. Nothing is written back, values only spare recomputation.
+template <typename Key, typename Value> class LruMap {
+private:
+  struct Entry {
+    Value value;
+    typename std::list<Key>::iterator lru_pos; // position in lru_
+  };
+
+  size_t capacity_;
+  // most recently used at the front
+  std::list<Key> lru_;
+  std::unordered_map<Key, Entry> entries_;
+
+public:
+  LruMap(size_t capacity) : capacity_(capacity) {}
+
+  // get value & mark it as recently used, nullptr if not stored
+  Value *find(const Key &key) {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+    return &it->second.value;
+  }
+
+  // insert or replace value, return the stored one
+  Value &put(const Key &key, Value value) {
+    if (auto *stored = find(key)) {
+      *stored = std::move(value);
+      return *stored;
+    }
+
+    // make space for one more
+    while (!lru_.empty() && entries_.size() >= capacity_) {
+      entries_.erase(lru_.back());
+      lru_.pop_back();
+    }
+
+    lru_.push_front(key);
+    auto &entry = entries_[key];
+    entry.value = std::move(value);
+    entry.lru_pos = lru_.begin();
+    return entry.value;
+  }
+
+  // forget one value
+  void erase(const Key &key) {
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      lru_.erase(it->second.lru_pos);
+      entries_.erase(it);
+    }
+  }
+
+  // forget everything
+  void clear() {
+    entries_.clear();
+    lru_.clear();
+  }
+
+  size_t size() const { return entries_.size(); }
+};
+
+} // namespace jkfs
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace jkfs {
+
+// In-memory copy of the on-disk table of shared clusters.
+// Entry i holds how many files use cluster i besides the first one, so a
+// cluster owned by a single file (and every free one) is 0 and allocation
+// never touches the table. On disk every entry is a little-endian uint16_t.
+// Every change marks its block of entries as dirty, so only changed parts
+// are written back.
+class RefcountTable {
+private:
+  std::vector<uint16_t> counts_;
+  std::vector<uint64_t> dirty_; // one bit per block of BLOCK entries
+  size_t shared_ = 0;           // how many entries are not 0
+  size_t extra_ = 0;            // sum of all entries
+
+  void mark_dirty(size_t idx);
+
+public:
+  static constexpr size_t ENTRY_SIZE = sizeof(uint16_t);
+
+  // replace content with on-disk bytes of <count> entries
+  // everything is clean afterwards
+  void load(std::span<const uint8_t> bytes, size_t count);
+  // reset to <count> zeros, everything is clean
+  void reset(size_t count);
+
+  // how many entries there are, 0 if the image doesn't share clusters
+  size_t size() const;
+  // how many files use the cluster besides the first one
+  uint16_t get(size_t idx) const;
+  // one more file uses the cluster, throw if it can't be counted
+  void share(size_t idx);
+  // one file stopped using the cluster; return false if it was the last one
+  // (entry stays 0), true if other files still use it
+  bool release(size_t idx);
+  // how many clusters are used by more than one file
+  size_t shared() const;
+  // how many references there are besides the first ones
+  size_t extra() const;
+
+  // on-disk representation of one byte
+  uint8_t byte(size_t byte_idx) const;
+  // byte ranges [start, start + count) which changed since last clean()
+  std::vector<std::pair<size_t, size_t>> dirty_ranges() const;
+  // forget all changes
+  void clean();
+};
+
+} // namespace jkfs
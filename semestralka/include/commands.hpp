@@ -2,8 +2,11 @@
 
 #include "CommandManager.hpp"
 #include "ICommand.hpp"
+#include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <string>
+#include <tuple>
 #include <vector>
 
 namespace jkfs {
@@ -58,6 +61,9 @@ public:
 struct Ls_Flags {
   bool list = false;
   bool all = false;
+  // page of shown items
+  size_t offset = 0;
+  size_t limit = std::numeric_limits<size_t>::max();
 };
 
 class LsCommand : public ICommand { // 6
@@ -67,6 +73,10 @@ protected:
 private:
   // get all flags from arguments
   Ls_Flags get_flags(const std::vector<std::string> &args);
+  // whole number <value> of <long_flag>, anything else is reported and <def>
+  // is used instead
+  size_t get_count(const std::string &value, const std::string &long_flag,
+                   size_t def);
   // find path to lookup
   std::string get_path(const std::vector<std::string> &args);
 
@@ -104,6 +114,8 @@ protected:
 
 private:
   void print_cluster_ranges(const std::vector<int32_t> &clusters);
+  // the same as inode operator<<, but for extent format
+  void print_extent_inode(const struct inode &inode);
 
 public:
   InfoCommand();
@@ -114,8 +126,12 @@ protected:
   void execute_inner(const std::vector<std::string> &args) override;
 
 private:
-  std::vector<uint8_t> read_real_file(const std::string &path);
-  void write_unreal_file(const std::string &path, std::vector<uint8_t> &input);
+  // opened file descriptor & file size
+  std::tuple<int, size_t> open_real_file(const std::string &path);
+  // check the target path & create file of given size, return its inode
+  int32_t create_unreal_file(const std::string &path, size_t size);
+  // copy the opened file into inode
+  void copy_into(int input, int32_t file_inode, size_t size);
 
 public:
   IncpCommand();
@@ -126,8 +142,10 @@ protected:
   void execute_inner(const std::vector<std::string> &args) override;
 
 private:
-  std::vector<uint8_t> read_unreal_file(const std::string &path);
-  void write_real_file(const std::string &path, std::vector<uint8_t> &input);
+  // inode of the copied file
+  int32_t find_unreal_file(const std::string &path);
+  // stream file content into the outside file
+  void write_real_file(const std::string &path, int32_t inode_id);
 
 public:
   OutcpCommand();
@@ -202,6 +220,8 @@ protected:
 
 private:
   bool has_force_flag(const std::vector<std::string> &args) const;
+  // unused name in directory to build the joined file under
+  std::string free_name(int32_t parent);
 
 public:
   XcpCommand();
@@ -215,6 +235,15 @@ public:
   AddCommand();
 };
 
+// write everything to the filesystem file & fsync it
+class SyncCommand : public ICommand { // USEFUL ADDITION
+protected:
+  void execute_inner(const std::vector<std::string> &args) override;
+
+public:
+  SyncCommand();
+};
+
 // show all available commands
 class HelpCommand : public ICommand { // USEFUL ADDITION
 protected:
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "IBlockDevice.hpp"
+
+namespace jkfs {
+
+// file accessed through std::fstream with seek + read/write
+class StreamDevice : public IBlockDevice {
+private:
+  std::filesystem::path path_;
+  std::fstream file_;
+  // size of the file, so it isn't looked up by path on every call
+  size_t size_ = 0;
+
+  // (re)open the file if it exists
+  void open();
+
+public:
+  StreamDevice(const std::string &path);
+
+  void read(size_t offset, void *data, size_t count) override;
+  void write(size_t offset, const void *data, size_t count) override;
+  void flush() override;
+  void sync() override;
+  void resize(size_t size) override;
+  size_t size() const override;
+  std::string name() const override;
+};
+
+// file accessed through pread/pwrite - no seeking, no user-space buffering
+class PosixDevice : public IBlockDevice {
+private:
+  std::filesystem::path path_;
+  int fd_ = -1;
+  // size of the file, so bounds checks don't need fstat
+  size_t size_ = 0;
+
+  // (re)open the file if it exists
+  void open();
+  void close();
+
+public:
+  PosixDevice(const std::string &path);
+  ~PosixDevice() override;
+  PosixDevice(const PosixDevice &other) = delete;
+  void operator=(const PosixDevice &other) = delete;
+
+  void read(size_t offset, void *data, size_t count) override;
+  void write(size_t offset, const void *data, size_t count) override;
+  void flush() override;
+  void sync() override;
+  void resize(size_t size) override;
+  size_t size() const override;
+  // copy_file_range, sendfile if it isn't supported between the files
+  size_t copy_to_fd(size_t offset, int fd, size_t fd_offset,
+                    size_t count) override;
+  size_t copy_from_fd(int fd, size_t fd_offset, size_t offset,
+                      size_t count) override;
+  std::string name() const override;
+};
+
+// whole file mapped into memory (MAP_SHARED)
+class MmapDevice : public IBlockDevice {
+private:
+  std::filesystem::path path_;
+  uint8_t *map_ = nullptr;
+  size_t size_ = 0;
+
+  // map the file if it exists and isn't empty
+  void map();
+  void unmap();
+
+public:
+  MmapDevice(const std::string &path);
+  ~MmapDevice() override;
+  MmapDevice(const MmapDevice &other) = delete;
+  void operator=(const MmapDevice &other) = delete;
+
+  void read(size_t offset, void *data, size_t count) override;
+  void write(size_t offset, const void *data, size_t count) override;
+  void flush() override;
+  void sync() override;
+  void resize(size_t size) override;
+  size_t size() const override;
+  uint8_t *data() override;
+  std::string name() const override;
+};
+
+// storage living only in RAM, lost on exit
+class RamDevice : public IBlockDevice {
+private:
+  std::vector<uint8_t> bytes_;
+
+public:
+  RamDevice() = default;
+
+  void read(size_t offset, void *data, size_t count) override;
+  void write(size_t offset, const void *data, size_t count) override;
+  void flush() override;
+  void sync() override;
+  void resize(size_t size) override;
+  size_t size() const override;
+  uint8_t *data() override;
+  std::string name() const override;
+};
+
+} // namespace jkfs
@@ -2,15 +2,26 @@
 
 #include <cstddef>
 #include <cstdint>
-#include <filesystem>
-#include <fstream>
-#include <ios>
+#include <functional>
+#include <memory>
 #include <mutex>
-#include <stdexcept>
+#include <set>
+#include <span>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "Bitmap.hpp"
+#include "ClusterCache.hpp"
+#include "DentryCache.hpp"
+#include "IBlockDevice.hpp"
+#include "LruMap.hpp"
+#include "RefcountTable.hpp"
 #include "structures.hpp"
 
 namespace jkfs {
@@ -32,9 +43,11 @@ concept Not_Pointer_Or_Reference =
 template <typename T>
 concept Raw_Writable = Trivially_Serializable<T> && Not_Pointer_Or_Reference<T>;
 
-enum class Bit_Order {
-  LSB_FIRST,
-  MSB_FIRST,
+// when are changes pushed from memory to the filesystem file
+enum class Durability {
+  ALWAYS, // after every single write
+  BATCH,  // at the end of every command
+  MANUAL, // only on 'sync' command or on exit
 };
 
 // storage for file_count_clusters(), so it can return more things at once
@@ -46,18 +59,49 @@ struct Needed_Clusters {
   size_t indirect2 = 0; // how many indirect clusters of 2nd order are needed
 };
 
+// pointers written into slots [first, first + values.size()) of one indirect
+// cluster
+struct Slot_Patch {
+  int32_t cluster = 0;
+  size_t first = 0;
+  std::vector<int32_t> values;
+};
+
+// resolved clusters of one file, the same as file_list_clusters() returns
+struct Block_Map {
+  std::vector<int32_t> data;
+  std::vector<int32_t> overhead;
+};
+
+// what file_extents__write() did, so it can be undone
+struct Extents_Write {
+  std::vector<int32_t> nodes;     // all extent nodes of the file, in order
+  std::vector<int32_t> new_nodes; // allocated nodes
+  std::vector<int32_t> unused;    // nodes the file no longer needs
+  // [cluster idx, raw node] of overwritten nodes
+  std::vector<std::pair<int32_t, std::vector<uint8_t>>> backup;
+};
+
+// receives consecutive parts of file, span is valid only during the call
+using Chunk_Reader = std::function<void(std::span<const uint8_t>)>;
+
+// receives directory items one by one, returns false to stop
+using Item_Visitor = std::function<bool(const dir_item &)>;
+// decides whether directory item is wanted
+using Item_Filter = std::function<bool(const dir_item &)>;
+
 // class representing the filesystem exposing API which is used by commands
 class Filesystem {
   // singleton behaviour
 private:
   static Filesystem *instance_;
   static std::mutex mutex_;
-  Filesystem(const std::string &filename);
+  Filesystem(std::unique_ptr<IBlockDevice> device);
   ~Filesystem() = default;
 
 public:
-  // initialize singleton
-  static Filesystem &instance(const std::string &filename);
+  // initialize singleton, filesystem lives on the given device
+  static Filesystem &instance(std::unique_ptr<IBlockDevice> device);
   // get instance
   static Filesystem &instance();
   Filesystem(Filesystem &other) = delete;
@@ -66,6 +110,15 @@ public:
   // config variables
 private:
   bool vocal_ = true;
+  Durability durability_ = Durability::BATCH;
+  // zero clusters on allocation, so no old data can ever be read back
+  bool secure_zero_ = false;
+  // on-disk format version used by format, B+tree directories are optional
+  int32_t format_version_ = superblock::VERSION_DIR_INDEX;
+  // max neighbouring clusters read/written from/to device at once
+  size_t run_max_ = 256;
+  // how many bytes are copied at once between host files and filesystem
+  size_t stream_chunk_ = 4 * 1024 * 1024;
   int32_t cluster_size_ = 4096;
   // how big can fs file be
   // superblock + 1 inode + 2 clusters + 1 byte for bitmapi + 1 byte for bitmapd
@@ -76,12 +129,51 @@ private:
   // i-nodes to data ratio
   double id_ratio_ = 0.05;
   static constexpr Bit_Order BIT_ORDER = Bit_Order::LSB_FIRST;
+  // written into superblock on format, checked on mount
+  static constexpr std::string_view SIGNATURE = "javok";
+  // inode_read_many() reads over up to this many bytes of unneeded inodes
+  // rather than starting another read; one read is at most INODE_READ_MAX
+  static constexpr size_t INODE_READ_GAP = 4096;
+  static constexpr size_t INODE_READ_MAX = 1 << 20;
 
   // member variables
 private:
-  // file in which FS is saved
-  std::filesystem::path path_;
-  std::fstream file_;
+  // storage in which FS is saved
+  std::unique_ptr<IBlockDevice> device_;
+
+  // clusters kept in memory between accesses, bypassed if the device itself
+  // is addressable in memory
+  ClusterCache cache_{256};
+  // backing storage of cluster_view() when cluster isn't in memory anywhere
+  std::vector<uint8_t> view_buffer_;
+  // allocated clusters never written since - their content on device is
+  // garbage, so they read as zeros and are zeroed on flush() if still unused
+  std::unordered_set<int32_t> unwritten_;
+  // block maps of recently used files, so their indirect clusters / extent
+  // nodes aren't walked on every access; kept up to date by file_ensure_size
+  static constexpr size_t BLOCK_MAPS_MAX = 1024;
+  LruMap<int32_t, Block_Map> block_maps_{BLOCK_MAPS_MAX};
+  // results of dir_lookup(), kept up to date by dir_item_add,
+  // dir_item_remove & rename, so warm paths resolve without reading anything
+  DentryCache dentries_{4096};
+  // offsets of empty items (holes left by removal) of recently used linear
+  // directories, the first one is reused by the next added item
+  static constexpr size_t DIR_HOLES_MAX = 1024;
+  LruMap<int32_t, std::set<int32_t>> dir_holes_{DIR_HOLES_MAX};
+  // directory with at least this many holes, which are at least half of its
+  // items, is compacted
+  static constexpr size_t DIR_COMPACT_MIN = 64;
+
+  // mounted state - superblock is read & validated only once, then served
+  // from memory until the device is formatted again
+  bool mounted_ = false;
+  struct superblock sb_{};
+  // bitmaps of used inodes & clusters, written back on flush()
+  Bitmap bitmapi_{BIT_ORDER};
+  Bitmap bitmapd_{BIT_ORDER};
+  // extra references of shared clusters, written back on flush(); empty if
+  // the image cannot share clusters
+  RefcountTable refcounts_;
 
   // ID of inode of current directory
   std::vector<int32_t> cwd_{0}; // always start at root
@@ -90,13 +182,36 @@ private:
 public:
   bool vocal() const;
   void vocal(bool vocal);
+  Durability durability() const;
+  void durability(Durability durability);
+  bool secure_zero() const;
+  void secure_zero(bool secure_zero);
+  int32_t format_version() const;
+  // throw if version is unknown
+  void format_version(int32_t version);
+  size_t stream_chunk() const;
+  // throw if chunk is empty
+  void stream_chunk(size_t bytes);
+  // name of the device, e.g. path to the file
   std::string path() const;
-  void path(const std::string &path);
-  // stream cannot be changed to another file, but inside file whatever
-  std::fstream &file();
+  // device cannot be changed, but inside device whatever
+  IBlockDevice &device();
+  ClusterCache &cache();
+  DentryCache &dentries();
 
+  // return the cached superblock, mount the filesystem first if needed
   struct superblock superblock();
+  // write superblock to file, clear bitmaps & refresh the cached copy
   void superblock(const struct superblock &sb);
+  // if the mounted filesystem describes file data by extents
+  bool uses_extents();
+  // if clusters of the mounted filesystem can be shared by more files
+  bool uses_refcounts();
+  // if big directories of the mounted filesystem are promoted to hashed index
+  // (or to B+tree)
+  bool uses_dir_index();
+  // if big directories of the mounted filesystem are promoted to B+tree
+  bool uses_dir_tree();
 
   // return root directory inode
   struct inode root_inode();
@@ -114,16 +229,33 @@ public:
 
   // methods
 public:
+  // == mount ==
+
+  // read superblock from file & validate it, throw if file isn't formatted
+  // load both bitmaps into memory
+  void mount();
+  // forget everything loaded by mount(), next access will mount again
+  void unmount();
+  bool mounted() const;
+  // write back everything held in memory & flush the device
+  void flush();
+  // flush & make everything durable on the device (fsync)
+  void sync();
+  // every command calls this when done, flushes if durability is BATCH
+  void end_command();
+
   // print info about superblock usage based on sb and position after counting
   // all really used bytes in fs
   void print_usage_info(struct superblock &sb) const;
-  // get indexes of 1s in bitmap
-  std::vector<int32_t> get_bitmap_idxs(int32_t start_addr, size_t bytes_count);
+  // get indexes of used inodes (1s in bitmap of inodes)
+  std::vector<int32_t> get_bitmapi_idxs();
+  // get indexes of used clusters (1s in bitmap of clusters)
+  std::vector<int32_t> get_bitmapd_idxs();
+  // how many clusters would be used if no cluster was shared
+  size_t clusters_logical();
 
   // == format ==
 
-  // create file if it doesn't exist
-  void filesystem_ensure();
   // resize filesystem to new size, does not gurantee data coherance except for
   // superblock - its existence is guaranteed. size must fulfil: fs_min_size <=
   // size <= fs_max_size
@@ -134,7 +266,10 @@ public:
   // find & return inode by its ID
   // ID = index in 'array of inodes'
   struct inode inode_read(int32_t inode_id);
-  // find ID of first empty inode place
+  // inode_read() of every ID, in the same order; the inode table is read in
+  // as few contiguous ranges as possible
+  std::vector<struct inode> inode_read_many(std::span<const int32_t> ids);
+  // find ID of next empty inode place after the last allocated one
   // mark as used
   // return -1 if none found
   int32_t inode_alloc();
@@ -151,10 +286,19 @@ public:
   // get vector of all bytes in cluster
   // doesn't matter if cluster is used or not
   std::vector<uint8_t> cluster_read(int32_t cluster_index);
-  // find idx of first empty cluster
-  // set cluster in bitmap as used
+  // get bytes of cluster without copying if possible (cache, memory
+  // addressable device); span is valid only until the next cluster access
+  std::span<const uint8_t> cluster_view(int32_t cluster_index);
+  // find idx of next empty cluster after the last allocated one
+  // set cluster in bitmap as used, content reads as zeros
   // return -1 if none found
   int32_t cluster_alloc();
+  // allocate <count> zeroed clusters, preferably one contiguous run at or
+  // after <goal> (< 0 means after the last allocated cluster), otherwise as
+  // few runs as possible (longest first)
+  // marks every run in bitmap at once
+  // return empty vector if there isn't enough free clusters
+  std::vector<int32_t> cluster_alloc(size_t count, int32_t goal);
   // check if cluster at index is empty
   bool cluster_is_empty(int32_t cluster_index);
   // write raw data to a cluster on index
@@ -165,6 +309,7 @@ public:
   void cluster_write(int32_t cluster_index, const char *data,
                      int32_t data_size);
   // set cluster bitmap as unused
+  // if other files share the cluster, only one reference is dropped
   // MAY or may NOT clear the memory
   void cluster_free(int32_t cluster_index);
 
@@ -187,11 +332,44 @@ public:
   // be written to; if file is too small, will be resized
   void file_write(int32_t inode_id, int32_t offset, const char *data,
                   size_t data_size);
+  // copy <length> bytes from <src_offset> of one file to <dst_offset> of
+  // another (or the same) one, destination is enlarged if needed but never
+  // shrunk; data go through a buffer of stream_chunk() bytes at most
+  void file_copy_range(int32_t src_inode_id, size_t src_offset,
+                       int32_t dst_inode_id, size_t dst_offset, size_t length);
   // handle read accross multiple clusters
   std::vector<uint8_t> file_read(int32_t inode_id);
+  // read up to out.size() bytes from <offset>, return how many were read
+  // (less only at the end of file)
+  size_t file_read(int32_t inode_id, size_t offset, std::span<uint8_t> out);
+  // pass bytes [offset, offset + length) of file to reader in order, clipped to
+  // file size; only clusters covering the range are mapped & read, and
+  // neighbouring clusters come in one span (read from device at once)
+  void file_read_chunks(int32_t inode_id, size_t offset, size_t length,
+                        const Chunk_Reader &reader);
+  // write whole file into host file <fd> from its start; runs of clusters
+  // which are on device are copied inside the kernel if device can do it
+  void file_copy_out(int32_t inode_id, int fd);
+  // fill file already sized to <size> bytes (file_create_sized) from the
+  // start of host file <fd>, whole clusters inside the kernel if device can
+  // do it, the rest through memory; file size is set to how many bytes were
+  // copied & returned (less if fd is shorter)
+  size_t file_copy_in(int32_t inode_id, int fd, size_t size);
+  // data clusters [first, first + count) of file, fewer if file ends sooner
+  // resolves only the needed part of (in)directs if block map isn't cached
+  std::vector<int32_t> file_map_range(int32_t inode_id, size_t first,
+                                      size_t count);
   // remove file & remove from parent directory
   // works on both files/directories
   void file_delete(int32_t parent_inode_id, std::string file_name);
+  // create file <file_name> in parent which shares all data clusters of
+  // <src_inode_id>, only extents are written; the first write into a shared
+  // cluster gives the writing file its own copy
+  // only for regular files of images which use refcounts
+  // return inode id
+  // IS ATOMIC
+  int32_t file_clone(int32_t src_inode_id, int32_t parent_inode_id,
+                     const std::string &file_name);
 
   // NOT WISE TO USE OUTSIDE FILESYSTEM
   // is more of a private function
@@ -207,6 +385,11 @@ public:
   // 3. from indirect2 all indirect1s
   std::tuple<std::vector<int32_t>, std::vector<int32_t>>
   file_list_clusters(int32_t inode_id);
+  // list data clusters as extents, in order
+  // return {data extents, overhead clusters}
+  // in legacy format extents are merged from data clusters
+  std::tuple<std::vector<struct extent>, std::vector<int32_t>>
+  file_list_extents(int32_t inode_id);
 
   // == dir ==
 
@@ -234,10 +417,31 @@ public:
                      const std::string &lookup_name);
   // list all dir_items in one directory
   std::vector<dir_item> dir_list(int32_t directory_inode_id);
+  // pass items whose name starts with <prefix> to visitor in name order
+  // B+tree directory is read leaf by leaf from the first such name, any
+  // other is listed whole & sorted
+  void dir_scan(int32_t directory_inode_id, const std::string &prefix,
+                const Item_Visitor &visitor);
+  // dir_scan() items accepted by filter, without the first <offset> of them
+  // & at most <limit>; scan stops once the page is full
+  std::vector<dir_item> dir_page(int32_t directory_inode_id,
+                                 const std::string &prefix,
+                                 const Item_Filter &filter, size_t offset,
+                                 size_t limit);
+  // dir_page() with inode of every item, see inode_read_many()
+  std::vector<std::pair<dir_item, struct inode>>
+  dir_list_plus(int32_t directory_inode_id, const std::string &prefix,
+                const Item_Filter &filter, size_t offset, size_t limit);
   // is inode a directory?
   bool dir_is(int32_t inode_id);
   // is directory empty?
   bool dir_empty(int32_t dir_inode_id);
+  // move item <src_name> of <src_parent> into <dst_parent> as <dst_name>
+  // only directory entries change (and .. of moved directory), file content
+  // is never read
+  // IS ATOMIC
+  void rename(int32_t src_parent_inode_id, const std::string &src_name,
+              int32_t dst_parent_inode_id, const std::string &dst_name);
 
   // == path ==
 
@@ -262,61 +466,65 @@ private:
   // write anything into file - beware: if structure is something more
   // complex, make sure it can be casted into <const char *>
   template <Raw_Writable STRUCTURE>
-  void write(const STRUCTURE &structure, std::streamoff offset,
-             std::ios_base::seekdir way = std::ios::beg) {
-    file_.clear();
-
-    file_.seekp(offset, way);
-    file_.write(reinterpret_cast<const char *>(&structure), sizeof(structure));
-
-    if (!file_) {
-      throw std::runtime_error("Cannot write into file.");
-    }
-
-    file_.flush();
+  void write(const STRUCTURE &structure, size_t offset) {
+    device_->write(offset, &structure, sizeof(structure));
+    write_done();
   }
 
   // read anything from file - beware: structure T *MUST* be constructable via
   // 'T name{};' and be castable to <char *>
-  template <Raw_Writable STRUCTURE>
-  STRUCTURE read(std::streamoff offset,
-                 std::ios_base::seekdir way = std::ios::beg) {
+  template <Raw_Writable STRUCTURE> STRUCTURE read(size_t offset) {
     STRUCTURE s{};
-    file_.clear();
-
-    file_.seekg(offset, way);
-    file_.read(reinterpret_cast<char *>(&s), sizeof(s));
-
-    if (!file_) {
-      throw std::runtime_error("Cannot read from file.");
-    }
-
+    device_->read(offset, &s, sizeof(s));
     return s;
   }
 
+  // == clusters ==
+
+  // is cluster cache used for current device
+  bool cluster_cached() const;
+  // are clusters zeroed when allocated - with secure zero, and with ALWAYS
+  // durability, where a crash before flush() mustn't leave old data in a
+  // cluster the bitmap on device already calls used
+  bool cluster_zeroed_on_alloc() const;
+  // current content of cluster is on device, not only in memory
+  bool cluster_on_device(int32_t cluster_index) const;
+  // write cluster content straight to device, bypass the cache
+  void cluster_store(int32_t cluster_index, const std::vector<uint8_t> &data);
+  // put full cluster content into cache or device, bitmap is untouched
+  void cluster_put(int32_t cluster_index, std::vector<uint8_t> data);
+  // write <count> neighbouring used clusters from <data> with one device
+  // write, only when cache isn't used; bitmap is untouched
+  void cluster_put_run(int32_t first_cluster, size_t count,
+                       std::span<const uint8_t> data);
+  // overwrite <size> bytes at <offset> of used cluster, rest is kept without
+  // reading it from device
+  void cluster_patch(int32_t cluster_index, size_t offset, const char *data,
+                     size_t size);
+
   // == byte-wise ==
 
+  // called after every write into device, flushes if durability is ALWAYS
+  void write_done();
+
   // write raw bytes (but as char * because of stream) into anywhere
-  void write_bytes(const char *data, size_t count, std::streamoff offset,
-                   std::ios_base::seekdir way = std::ios::beg);
+  void write_bytes(const char *data, size_t count, size_t offset);
 
   // read raw bytes from FS, useful for bitmaps
-  std::vector<uint8_t> read_bytes(size_t count, std::streamoff offset,
-                                  std::ios_base::seekdir way = std::ios::beg);
-
-  // == bit-wise ==
+  std::vector<uint8_t> read_bytes(size_t count, size_t offset);
 
-  // get/set/clear bit at index in byte - usefull for bitmaps not to be confused
-  // by LSB or MSB ordering - that is retrieved from filesystem::BIT_ORDER
-  // they take logical bit index and work with it in physical
-  bool bit_get(uint8_t byte, uint32_t bit_index);
-  void bit_set(uint8_t &byte, uint32_t bit_index);
-  void bit_clear(uint8_t &byte, uint32_t bit_index);
+  // == bitmaps ==
 
-  // get first bit in vector which is 0 or 1 based on value
-  // return index of bit, classic 0-indexed
-  // return -1 if value not found in vec
-  int32_t get_first_bit(std::vector<uint8_t> &vec, bool value);
+  // set/clear bit of inode/cluster in memory, write it immediately only if
+  // durability is ALWAYS
+  void bitmap_mark(Bitmap &bitmap, int32_t idx, bool used);
+  // the same for bits [start, start + count)
+  void bitmap_mark(Bitmap &bitmap, int32_t start, size_t count, bool used);
+  // write changed parts of both bitmaps & of refcount table into file
+  void bitmaps_store();
+  // one more file uses the cluster, write it immediately only if durability
+  // is ALWAYS
+  void cluster_share(int32_t cluster_index);
 
   // == FORMAT ==
 
@@ -328,8 +536,78 @@ private:
   int32_t count_inodes(int32_t available_space, int32_t cluster_count) const;
   // create superblock for filesystem of given size with the use of
   struct superblock sb_from_size(int32_t size) const;
-  // clears bitmap of inodes and bitmap of clusters
+  // clears bitmap of inodes and bitmap of clusters (and refcount table), in
+  // file and in memory
   void clear_bitmaps(const struct superblock &sb);
+  // bytes of refcount table per cluster in the format version which is used
+  // by format, 0 if it cannot share clusters
+  int32_t refcount_entry_size() const;
+
+  // == dir ==
+
+  // byte offset of item inside directory, -1 if it isn't there
+  int32_t dir_item_offset(int32_t directory_inode_id,
+                          const std::string &item_name);
+  // overwrite item at <offset> in place, size of directory is kept
+  void dir_item_write(int32_t directory_inode_id, int32_t offset,
+                      const dir_item &item);
+  // remove item at <offset> by clearing its slot, directory only shrinks if
+  // it was the last one or when too many slots are empty
+  void dir_item_erase(int32_t directory_inode_id, int32_t offset);
+  // offsets of empty items of linear directory, it is walked on first use
+  std::set<int32_t> &dir_holes(int32_t directory_inode_id);
+  // rewrite linear directory without its holes
+  void dir_compact(int32_t directory_inode_id);
+  // first item of directory, valid() as dir_index or dir_tree if the
+  // directory isn't linear
+  struct dir_item dir_head(int32_t directory_inode_id);
+  // are items of directory one after another (with holes)
+  bool dir_linear(int32_t directory_inode_id);
+  void dir_index__write(int32_t directory_inode_id,
+                        const struct dir_index &index);
+  // {offset, inode id} of item in the bucket of its name, {-1, -1} if it
+  // isn't there
+  std::tuple<int32_t, int32_t> dir_index__find(int32_t directory_inode_id,
+                                               const struct dir_index &index,
+                                               const std::string &item_name);
+  // put item into a free slot of its bucket, if the bucket is full rebuild
+  // the index with more buckets
+  // IS ATOMIC
+  void dir_index__add(int32_t directory_inode_id, struct dir_index index,
+                      const dir_item &item);
+  // rewrite whole directory as index of <items> with at least <buckets>
+  // buckets, twice as many until no bucket overflows
+  // IS ATOMIC
+  void dir_index__build(int32_t directory_inode_id,
+                        const std::vector<dir_item> &items, int32_t buckets);
+  void dir_tree__write(int32_t directory_inode_id, const struct dir_tree &tree);
+  // slots of node (header first), items past its count are empty
+  std::vector<dir_item> dir_tree__node(int32_t directory_inode_id,
+                                       int32_t node);
+  void dir_tree__store(int32_t directory_inode_id, int32_t node,
+                       const std::vector<dir_item> &slots);
+  // nodes from root to the leaf where <item_name> belongs & slots of the leaf
+  std::tuple<std::vector<int32_t>, std::vector<dir_item>>
+  dir_tree__path(int32_t directory_inode_id, const struct dir_tree &tree,
+                 std::string_view item_name);
+  // {offset, inode id} of item, {-1, -1} if it isn't there
+  std::tuple<int32_t, int32_t> dir_tree__find(int32_t directory_inode_id,
+                                              const struct dir_tree &tree,
+                                              const std::string &item_name);
+  // insert item into its leaf, full nodes on the way up are split in half
+  // IS ATOMIC
+  void dir_tree__add(int32_t directory_inode_id, struct dir_tree tree,
+                     const dir_item &item);
+  // remove item at <offset> from its leaf, nodes are never merged
+  void dir_tree__erase(int32_t directory_inode_id, struct dir_tree tree,
+                       int32_t offset);
+  // rewrite whole directory as B+tree of <items>, nodes filled to 3/4
+  // IS ATOMIC
+  void dir_tree__build(int32_t directory_inode_id,
+                       std::vector<dir_item> items);
+  // dir_scan() of B+tree directory
+  void dir_tree__scan(int32_t directory_inode_id, const struct dir_tree &tree,
+                      const std::string &prefix, const Item_Visitor &visitor);
 
   // == path ==
 
@@ -342,7 +620,53 @@ private:
 
   // list all clusters indexes (in order) which are stored in given cluster
   std::vector<int32_t> file_list_clusters__indirect(int32_t cluster_idx);
-
+  // walk bytes [offset, offset + length) of file in order - runs of
+  // neighbouring clusters on device are passed as {address, count}, clusters
+  // held in memory as their content
+  void file_read__runs(int32_t inode_id, size_t offset, size_t length,
+                       const std::function<void(size_t, size_t)> &on_device,
+                       const Chunk_Reader &in_memory);
+  // whole <data> into host file <fd> at <offset>
+  static void fd_write(int fd, size_t offset, std::span<const uint8_t> data);
+  // up to data.size() bytes from host file <fd>, less only at its end
+  static size_t fd_read(int fd, size_t offset, std::span<uint8_t> data);
+  // file_list_clusters() without block map cache, reads inode & overhead
+  Block_Map file_list_clusters__walk(int32_t inode_id);
+  // remember block map of file, forget some other if there are too many
+  void file_block_map(int32_t inode_id, Block_Map map);
+  // read extents stored in inode & its chain of extent nodes
+  // return {extents, node clusters}
+  std::tuple<std::vector<struct extent>, std::vector<int32_t>>
+  file_list_extents__nodes(const struct inode &inode);
+  // how many extents fit inside one extent node cluster
+  size_t file_extents_in_node() const;
+  // file_ensure_size() for extent format
+  // allocate new data near the end of file, rewrite extents & nodes
+  // IS ATOMIC
+  void file_ensure_size__extents(int32_t inode_id, int32_t new_size);
+  // put <extents> into inode (only in memory) & into extent nodes, reusing
+  // <nodes> of the file & allocating more near <goal>
+  // everything done is recorded in <done>, see file_extents__undo()
+  void file_extents__write(struct inode &inode,
+                           const std::vector<struct extent> &extents,
+                           const std::vector<int32_t> &nodes, int32_t goal,
+                           Extents_Write &done);
+  // restore overwritten nodes & free allocated ones
+  void file_extents__undo(const Extents_Write &done);
+  // give the file its own copy of every shared cluster which overlaps bytes
+  // [offset, offset + size); clusters overwritten whole aren't copied
+  // IS ATOMIC
+  void file_unshare(int32_t inode_id, size_t offset, size_t size);
+  // if empty file's only cluster (allocated by file_create) stands in the way
+  // of contiguous data, and <count> clusters fit somewhere else
+  bool file_ensure_size__drop_placeholder(int32_t cluster, size_t count);
+
+  // write cluster indexes into slots of indirect cluster, other slots are kept
+  void file_write__slots(int32_t cluster_idx, size_t first_slot,
+                         const std::vector<int32_t> &values);
+  // file_write() without resizing, file must be big enough already
+  void file_write__range(int32_t inode_id, int32_t offset, const char *data,
+                         size_t data_size);
   // write data to any cluster, if offset > 0 will first read and only write
   // after existing data; modify written_bytes
   // this is convenience cluster_write() wrapper
@@ -359,31 +683,29 @@ private:
 
   // fill new_data & new_overhead with newly allocated clusters
   // how many is calculatd using <need>
+  // data are placed contiguously from <goal> if possible, overhead after them
   // return <new_data, new_overhead>
   // IS ATOMIC
   std::tuple<std::vector<int32_t>, std::vector<int32_t>>
   file_ensure_size__fill(const struct Needed_Clusters &need,
                          const size_t have_data_size,
-                         const size_t have_overhead_size);
+                         const size_t have_overhead_size, int32_t goal);
 
   // join two vectors into another one
   // IS ATOMIC
   std::vector<int32_t> file_ensure_size__join(std::vector<int32_t> &first,
                                               std::vector<int32_t> &second);
 
-  // writes overhead clusters to inode, fills indirect2 with indirect1 if needed
+  // assign data & overhead clusters from index <have_data>/<have_overhead>
+  // onwards to inode (only in memory) & slots of its indirect clusters
+  // slots before are untouched - growth costs only the new clusters
+  // return written slots, all of them were empty before
   // IS ATOMIC
-  void
-  file_ensure_size__write_overhead_clusters(struct inode &inode,
-                                            std::vector<int32_t> &clusters);
-
-  // write data clusters to inode & its overhead (indirect1/2) clusters
-  // It doesn't change the contents of data clusters, just writes their idx to
-  // inode/overhead clusters. IS ATOMIC
-  void
-  file_ensure_size__write_clusters_data(struct inode &inode,
-                                        std::vector<int32_t> &data,
-                                        const std::vector<int32_t> &overhead);
+  std::vector<Slot_Patch>
+  file_ensure_size__append(struct inode &inode,
+                           const std::vector<int32_t> &data, size_t have_data,
+                           const std::vector<int32_t> &overhead,
+                           size_t have_overhead);
 };
 
 } // namespace jkfs
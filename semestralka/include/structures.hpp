@@ -1,15 +1,26 @@
 #pragma once
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <ostream>
 #include <string>
+#include <string_view>
 
 namespace jkfs {
 
 struct superblock {
-  static constexpr int MAX_SIGN_LEN = 16;
+  static constexpr int MAX_SIGN_LEN = 12;
+  // on-disk format versions, images without version field read as 0
+  static constexpr int32_t VERSION_LEGACY = 1;  // direct/indirect pointers
+  static constexpr int32_t VERSION_EXTENTS = 2; // extents
+  static constexpr int32_t VERSION_REFLINK = 3; // extents, shared clusters
+  static constexpr int32_t VERSION_DIR_INDEX = 4; // + hashed big directories
+  static constexpr int32_t VERSION_DIR_TREE = 5;  // + B+tree big directories
+  static constexpr int32_t VERSION_CURRENT = VERSION_DIR_TREE;
+
   char signature[MAX_SIGN_LEN] = {}; // author login
+  int32_t version = 0;               // 0 is the same as VERSION_LEGACY
   int32_t disk_size = 0;             // celkova velikost VFS
 
   int32_t bitmapi_start_addr = 0; // bitmap i-node
@@ -24,12 +35,36 @@ struct superblock {
   int32_t cluster_size = 0; // cluster
   int32_t cluster_count = 0;
   int32_t data_start_addr = 0;
+
+  // since VERSION_REFLINK, older images end before them & read as 0
+  int32_t refcount_start_addr = 0; // extra references of clusters
+  int32_t refcount_size = 0;       // in bytes
+
+  // how many bytes are stored on disk for this version
+  size_t stored_size() const;
 };
 
 // write superblock to stream
 std::ostream &operator<<(std::ostream &os, const superblock &sb);
 
+// run of <length> clusters starting at <start>
+struct extent {
+  int32_t start = 0;
+  int32_t length = 0; // 0 = unused
+};
+
+// header of cluster with extents which didn't fit inside inode
+// followed by <count> extents, nodes of one file are chained by <next>
+struct extent_node {
+  int32_t count = 0;
+  int32_t next = 0; // cluster of next node, 0 = last one
+};
+
 struct inode {
+  // in VERSION_EXTENTS direct & indirect1 hold this many extents and
+  // indirect2 is the first extent_node cluster
+  static constexpr size_t EXTENTS = 3;
+
   int32_t node_id = 0;
   char is_dir = 0;
   int32_t file_size = 0;
@@ -39,6 +74,10 @@ struct inode {
 
   // set all member values to be the same as in other
   void copy_from(const inode &other);
+
+  // extents in VERSION_EXTENTS layout, idx < EXTENTS
+  struct extent extent(size_t idx) const;
+  void extent(size_t idx, const struct extent &e);
 };
 
 // write inode to stream
@@ -59,6 +98,8 @@ struct dir_item {
 
   // if any given name match the dir_item.item_name
   bool name_matches(const std::string &name) const;
+  // item_name without copying it
+  std::string_view name() const;
   // return if dir_item is empty
   bool empty() const;
 
@@ -69,4 +110,51 @@ struct dir_item {
 // write directory item to stream
 std::ostream &operator<<(std::ostream &os, const dir_item &dit);
 
+// first item of directory with hashed index (since VERSION_DIR_INDEX), its
+// name is empty, so everything which walks items one by one skips it
+// rest of the first cluster is unused, cluster i + 1 of directory is bucket i
+// holding items whose name hash % buckets == i, free slots are empty items
+struct dir_index {
+  static constexpr int32_t MAGIC = 0x78646968; // "hidx"
+  int32_t magic = MAGIC; // in place of dir_item::inode
+  char no_name = '\0';   // in place of dir_item::item_name[0]
+  char unused[3] = {};
+  int32_t buckets = 0; // power of 2
+  int32_t items = 0;   // used slots in all buckets
+
+  // is this a header and not an ordinary (or empty) item
+  bool valid() const;
+};
+static_assert(sizeof(dir_index) == sizeof(dir_item));
+
+// first item of directory kept as B+tree ordered by name (since
+// VERSION_DIR_TREE), empty name the same as dir_index; rest of the first
+// cluster is unused, cluster i >= 1 of directory is node i
+struct dir_tree {
+  static constexpr int32_t MAGIC = 0x65727462; // "btre"
+  int32_t magic = MAGIC; // in place of dir_item::inode
+  char no_name = '\0';   // in place of dir_item::item_name[0]
+  char unused[3] = {};
+  int32_t root = 0;  // node of root
+  int32_t items = 0; // items in all leaves
+
+  // is this a header and not an ordinary (or empty) item
+  bool valid() const;
+};
+static_assert(sizeof(dir_tree) == sizeof(dir_item));
+
+// first slot of B+tree node, followed by <count> items ordered by name
+// in leaf they are the directory items, in inner node dir_item::inode is
+// the child node with names >= dir_item::item_name (the first child also
+// with smaller ones)
+struct dir_node {
+  int32_t next = 0; // next leaf in name order, 0 = the last one
+  char no_name = '\0';
+  char leaf = 0;
+  char unused[2] = {};
+  int32_t count = 0;
+  int32_t reserved = 0;
+};
+static_assert(sizeof(dir_node) == sizeof(dir_item));
+
 } // namespace jkfs
@@ -30,12 +30,11 @@ void AddCommand::execute_inner(const std::vector<std::string> &args) {
   }
   auto to_id = to_id_path.back();
 
-  auto from_data = fs_.file_read(from_id);
-  auto to_inode = fs_.inode_read(to_id);
+  auto from_size = fs_.inode_read(from_id).file_size;
+  auto to_size = fs_.inode_read(to_id).file_size;
 
-  fs_.file_write(to_id, to_inode.file_size,
-                 reinterpret_cast<const char *>(from_data.data()),
-                 from_data.size());
+  fs_.file_copy_range(from_id, 0, to_id, static_cast<size_t>(to_size),
+                      static_cast<size_t>(from_size));
 }
 
 } // namespace jkfs
@@ -1,5 +1,8 @@
+#include <algorithm>
+#include <cstdint>
 #include <ios>
 #include <iostream>
+#include <span>
 #include <string>
 
 #include "commands.hpp"
@@ -38,14 +41,19 @@ void CatCommand::execute_inner(const std::vector<std::string> &args) {
     throw command_error("Cannot cat a directory: " + path);
   }
 
-  auto bytes = fs_.file_read(inode);
-
-  // write bytes to stdout
-  std::cout.write(reinterpret_cast<const char *>(bytes.data()),
-                  static_cast<std::streamsize>(bytes.size()));
+  // write bytes to stdout as soon as they are read
+  char last = '\0';
+  auto size = static_cast<size_t>(std::max(fs_.inode_read(inode).file_size, 0));
+  fs_.file_read_chunks(inode, 0, size,
+                       [&last](std::span<const uint8_t> chunk) {
+                         std::cout.write(
+                             reinterpret_cast<const char *>(chunk.data()),
+                             static_cast<std::streamsize>(chunk.size()));
+                         last = static_cast<char>(chunk.back());
+                       });
 
   // only add a newline if the last byte isn't already '\n'
-  if (bytes.empty() || bytes.back() != '\n') {
+  if (last != '\n') {
     std::cout << std::endl;
   }
 }
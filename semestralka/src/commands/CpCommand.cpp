@@ -29,7 +29,6 @@ void CpCommand::execute_inner(const std::vector<std::string> &args) {
     throw command_error("cannot find source file");
   }
   auto source = source_path.back();
-  auto data = fs_.file_read(source);
 
   // get parent
   auto tgt_path_str = args[1];
@@ -42,6 +41,11 @@ void CpCommand::execute_inner(const std::vector<std::string> &args) {
 
   auto target_path = fs_.path_lookup(args[1]);
 
+  // copying onto itself, nothing to do
+  if (!target_path.empty() && target_path.back() == source) {
+    return;
+  }
+
   // something is on target path
   if (!target_path.empty()) {
     if (has_force_flag(args)) {
@@ -59,11 +63,22 @@ void CpCommand::execute_inner(const std::vector<std::string> &args) {
     }
   }
 
+  // share clusters of source, they are copied only when written to
+  if (fs_.uses_refcounts() && !fs_.dir_is(source)) {
+    fs_.file_clone(source, parent, fs_.path_filename(tgt_path_str));
+    return;
+  }
+
   // create new file & copy contents
-  auto target = fs_.file_create_sized(parent, fs_.path_filename(tgt_path_str),
-                                      data.size());
-  fs_.file_write(target, 0, reinterpret_cast<const char *>(data.data()),
-                 data.size());
+  auto size = fs_.inode_read(source).file_size;
+  auto target =
+      fs_.file_create_sized(parent, fs_.path_filename(tgt_path_str), size);
+  try {
+    fs_.file_copy_range(source, 0, target, 0, static_cast<size_t>(size));
+  } catch (...) {
+    fs_.file_delete(parent, fs_.path_filename(tgt_path_str));
+    throw;
+  }
 }
 
 bool CpCommand::has_force_flag(const std::vector<std::string> &args) const {
@@ -46,6 +46,9 @@ void ExecCommand::execute_inner(const std::vector<std::string> &args) {
                                   // Null terminator for execvp
                                   nullptr};
 
+  // the shell may look at the filesystem file, show it the current state
+  fs_.flush();
+
   // Fork process
   pid_t pid = fork();
   if (pid < 0) {
@@ -1,10 +1,14 @@
 #include <cstddef>
 #include <cstdint>
-#include <fstream>
-#include <ios>
+#include <limits>
 #include <string>
+#include <tuple>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "commands.hpp"
 #include "errors.hpp"
 
@@ -22,37 +26,51 @@ void IncpCommand::execute_inner(const std::vector<std::string> &args) {
     throw command_error("The incp command expects two arguments.");
   }
 
-  auto input = read_real_file(args[0]);
-  write_unreal_file(args[1], input);
+  auto [input, size] = open_real_file(args[0]);
+  try {
+    auto file_inode = create_unreal_file(args[1], size);
+    try {
+      copy_into(input, file_inode, size);
+    } catch (...) {
+      // don't leave half-copied file behind
+      fs_.file_delete(fs_.path_lookup(fs_.path_parent_dir(args[1])).back(),
+                      fs_.path_filename(args[1]));
+      throw;
+    }
+  } catch (...) {
+    ::close(input);
+    throw;
+  }
+  ::close(input);
 }
 
-std::vector<uint8_t> IncpCommand::read_real_file(const std::string &path) {
+std::tuple<int, size_t> IncpCommand::open_real_file(const std::string &path) {
   // open file
-  std::ifstream file(path, std::ios::binary);
-  if (!file) {
+  int file = ::open(path.c_str(), O_RDONLY);
+  if (file < 0) {
     failure_message_ = "FILE NOT FOUND (není zdroj)";
     throw command_error("Cannot read the input file.");
   }
 
   // get filesize
-  file.seekg(0, std::ios::end);
-  size_t size = static_cast<size_t>(file.tellg());
-  file.seekg(0, std::ios::beg);
-
-  // read into buffer
-  std::vector<uint8_t> buffer(size);
-  file.read(reinterpret_cast<char *>(buffer.data()),
-            static_cast<std::streamsize>(size));
+  struct stat st{};
+  if (::fstat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+    ::close(file);
+    failure_message_ = "FILE NOT FOUND (není zdroj)";
+    throw command_error("Cannot read the input file.");
+  }
+  auto size = static_cast<size_t>(st.st_size);
 
-  // close file
-  file.close();
+  if (size > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+    ::close(file);
+    throw command_error("The input file is too big for this filesystem.");
+  }
 
-  // return
-  return buffer;
+  return {file, size};
 }
 
-void IncpCommand::write_unreal_file(const std::string &string_path,
-                                    std::vector<uint8_t> &input) {
+int32_t IncpCommand::create_unreal_file(const std::string &string_path,
+                                        size_t size) {
   std::string path(string_path);
 
   auto path_inodes = fs_.path_lookup(string_path);
@@ -73,10 +91,15 @@ void IncpCommand::write_unreal_file(const std::string &string_path,
     throw command_error("trying to use file as parent directory");
   }
 
-  auto file_inode = fs_.file_create_sized(parent_inode, fs_.path_filename(path),
-                                          input.size());
-  fs_.file_write(file_inode, 0, reinterpret_cast<const char *>(input.data()),
-                 input.size());
+  // all clusters at once, so writes only fill them
+  return fs_.file_create_sized(parent_inode, fs_.path_filename(path),
+                               static_cast<int32_t>(size));
+}
+
+void IncpCommand::copy_into(int input, int32_t file_inode, size_t size) {
+  // memory stays the same no matter how big the file is, file gets shorter
+  // if input did since it was opened
+  fs_.file_copy_in(file_inode, input, size);
 }
 
 } // namespace jkfs
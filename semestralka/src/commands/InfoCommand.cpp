@@ -31,7 +31,11 @@ void InfoCommand::execute_inner(const std::vector<std::string> &args) {
   auto inode = fs_.inode_read(inode_id);
   auto clusters = fs_.file_list_clusters(inode_id);
 
-  std::cout << inode << std::endl;
+  if (fs_.uses_extents()) {
+    print_extent_inode(inode);
+  } else {
+    std::cout << inode << std::endl;
+  }
 
   auto this_clusters = std::get<0>(clusters);
   std::cout << "used clusters:\n 1.data(" << this_clusters.size() << "): ";
@@ -44,6 +48,18 @@ void InfoCommand::execute_inner(const std::vector<std::string> &args) {
   std::cout << std::endl;
 }
 
+void InfoCommand::print_extent_inode(const struct inode &inode) {
+  std::cout << "inode{\n"
+            << " node_id=" << inode.node_id
+            << ",\n is_dir=" << (inode.is_dir ? "true" : "false")
+            << ",\n file_size=" << inode.file_size << "b";
+  for (size_t i = 0; i < inode::EXTENTS; i++) {
+    auto e = inode.extent(i);
+    std::cout << ",\n extent" << i + 1 << "=" << e.start << "+" << e.length;
+  }
+  std::cout << ",\n extent_node=" << inode.indirect2 << "\n }" << std::endl;
+}
+
 void InfoCommand::print_cluster_ranges(const std::vector<int32_t> &clusters) {
   if (clusters.empty())
     return;
@@ -1,7 +1,10 @@
-#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <filesystem>
 #include <iostream>
-#include <sstream>
+#include <limits>
 #include <string>
+#include <vector>
 
 #include "commands.hpp"
 #include "errors.hpp"
@@ -12,7 +15,7 @@ LsCommand::LsCommand() {
   id_ = "ls";
   name_ = "List directory";
   desc_ = "List all items in directory.";
-  how_ = "ls [path] [options]";
+  how_ = "ls [path] [options] [--offset <n>] [--limit <n>]";
   exmp_ = {"ls // cwd",
            "ls . // cwd",
            "ls subdir // subdir",
@@ -21,7 +24,9 @@ LsCommand::LsCommand() {
            "ls -l // will list with more info and in list",
            "ls -a // will show even hidden files",
            "ls -la // combination of options",
-           "ls subdir -la // combination of path & options"};
+           "ls subdir -la // combination of path & options",
+           "ls subdir/pre* // only names starting with 'pre'",
+           "ls --offset 100 --limit 50 // 101st to 150th item"};
 
   success_message_ = "";
   failure_message_ = "PATH NOT FOUND (neexistujici adresar)";
@@ -31,6 +36,15 @@ void LsCommand::execute_inner(const std::vector<std::string> &args) {
   std::string path = get_path(args);
   auto flags = get_flags(args);
 
+  // "dir/pre*" lists names in dir starting with "pre"
+  std::string prefix;
+  if (!path.empty() && path.back() == '*') {
+    std::filesystem::path pattern(path);
+    prefix = pattern.filename();
+    prefix.pop_back();
+    path = pattern.parent_path();
+  }
+
   auto cwd_path = fs_.path_lookup(path);
   if (cwd_path.empty()) {
     throw command_error("empty cwd path");
@@ -44,43 +58,46 @@ void LsCommand::execute_inner(const std::vector<std::string> &args) {
     return;
   }
 
-  auto items = fs_.dir_list(cwd);
-  std::sort(items.begin(), items.end());
-
-  for (const auto &item : items) {
-    if (!flags.all) { // show all
-      if (item.item_name[0] == '.') {
-        continue;
-      }
-    }
-
-    std::ostringstream str;
-    auto inode = fs_.inode_read(item.inode);
-
-    str << item.item_name.data();
-    if (flags.list) {
-      str << (inode.is_dir ? " DIR " : " FILE ") << inode.file_size << "b "
-          << inode.node_id << std::endl;
-    } else {
-      str << " ";
+  // items come in name order, only the shown page is kept
+  auto shown = [&flags](const dir_item &item) {
+    return flags.all || item.item_name[0] != '.'; // show all
+  };
+
+  if (flags.list) {
+    // inodes of the whole page at once, in a few large reads
+    for (const auto &[item, inode] : fs_.dir_list_plus(
+             cwd, prefix, shown, flags.offset, flags.limit)) {
+      std::cout << item.item_name.data()
+                << (inode.is_dir ? " DIR " : " FILE ") << inode.file_size
+                << "b " << inode.node_id << std::endl;
     }
-
-    std::cout << str.str();
+    return;
   }
 
-  if (!flags.list) {
-    std::cout << std::endl;
+  for (const auto &item :
+       fs_.dir_page(cwd, prefix, shown, flags.offset, flags.limit)) {
+    std::cout << item.item_name.data() << " ";
   }
+  std::cout << std::endl;
 }
 
 Ls_Flags LsCommand::get_flags(const std::vector<std::string> &args) {
   Ls_Flags flags;
 
   // for every argument
-  for (const auto &arg : args) {
+  for (size_t i = 0; i < args.size(); i++) {
+    const auto &arg = args[i];
     if (arg.empty() || arg[0] != '-') {
       continue;
     }
+    if (arg.starts_with("--")) {
+      if (i + 1 < args.size() && arg == "--offset") {
+        flags.offset = get_count(args[++i], arg, flags.offset);
+      } else if (i + 1 < args.size() && arg == "--limit") {
+        flags.limit = get_count(args[++i], arg, flags.limit);
+      }
+      continue;
+    }
     // for every char
     for (const auto ch : arg) {
       switch (ch) {
@@ -97,6 +114,21 @@ Ls_Flags LsCommand::get_flags(const std::vector<std::string> &args) {
   return flags;
 }
 
+size_t LsCommand::get_count(const std::string &value,
+                            const std::string &long_flag, size_t def) {
+  size_t count = 0;
+  const auto *end = value.data() + value.size();
+  auto [ptr, ec] = std::from_chars(value.data(), end, count);
+  if (ec != std::errc{} || ptr != end) {
+    auto unlimited = def == std::numeric_limits<size_t>::max();
+    std::cout << "Invalid value '" << value << "' of " << long_flag
+              << ", using " << (unlimited ? "no limit" : std::to_string(def))
+              << "." << std::endl;
+    return def;
+  }
+  return count;
+}
+
 std::string LsCommand::get_path(const std::vector<std::string> &args) {
   if (args.empty()) {
     return "";
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <filesystem>
 #include <iostream>
 #include <string>
 
@@ -34,7 +36,13 @@ void MvCommand::execute_inner(const std::vector<std::string> &args) {
   if (source == 0) {
     throw command_error("cannot move ROOT DIRECTORY :=)");
   }
-  auto data = fs_.file_read(source);
+
+  // only directory entries change
+  auto source_parent_path = fs_.path_lookup(source_path.parent_path());
+  if (source_parent_path.empty()) {
+    throw command_error("source parent path empty");
+  }
+  auto source_parent = source_parent_path.back();
 
   // get parent for TARGET create/delete
   std::filesystem::path target_path(args[1]);
@@ -47,9 +55,29 @@ void MvCommand::execute_inner(const std::vector<std::string> &args) {
 
   auto target_path_i = fs_.path_lookup(args[1]);
 
+  // moving onto itself, nothing to do
+  if (!target_path_i.empty() && target_path_i.back() == source) {
+    return;
+  }
+
+  // everything rename could refuse is checked before the target is deleted,
+  // failed move mustn't cost the target
+  if (std::ranges::find(target_parent_path, source) !=
+      target_parent_path.end()) {
+    throw command_error("cannot move directory inside itself");
+  }
+
   // something is on target path
   if (!target_path_i.empty()) {
     if (has_force_flag(args)) {
+      auto target = target_path_i.back();
+      if (std::ranges::find(source_path_i, target) != source_path_i.end()) {
+        throw command_error("cannot replace directory holding the source");
+      }
+      if (fs_.dir_is(target) && !fs_.dir_empty(target)) {
+        throw command_error("cannot replace non-empty directory");
+      }
+
       // have permission to kill
       fs_.file_delete(target_parent, target_path.filename());
     } else {
@@ -64,15 +92,8 @@ void MvCommand::execute_inner(const std::vector<std::string> &args) {
     }
   }
 
-  // remove directory entry & add new directory entry
-  auto source_parent_path = fs_.path_lookup(source_path.parent_path());
-  if (source_parent_path.empty()) {
-    throw command_error("source parent path empty");
-  }
-  auto source_parent = source_parent_path.back();
-
-  fs_.dir_item_add(target_parent, source, target_path.filename());
-  fs_.dir_item_remove(source_parent, source_path.filename());
+  fs_.rename(source_parent, source_path.filename(), target_parent,
+             target_path.filename());
 }
 
 bool MvCommand::has_force_flag(const std::vector<std::string> &args) const {
@@ -1,7 +1,9 @@
-#include <fstream>
-#include <ios>
+#include <cstdint>
 #include <string>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "commands.hpp"
 #include "errors.hpp"
 
@@ -22,33 +24,37 @@ void OutcpCommand::execute_inner(const std::vector<std::string> &args) {
     throw command_error("The outcp command requires two arguments.");
   }
 
-  auto data = read_unreal_file(args[0]);
-  write_real_file(args[1], data);
+  auto inode_id = find_unreal_file(args[0]);
+  write_real_file(args[1], inode_id);
 }
 
-std::vector<uint8_t> OutcpCommand::read_unreal_file(const std::string &path) {
+int32_t OutcpCommand::find_unreal_file(const std::string &path) {
   auto inode_id_path = fs_.path_lookup(path);
   if (inode_id_path.empty()) {
     throw command_error("invalid path");
   }
-  auto inode_id = inode_id_path.back();
 
-  return fs_.file_read(inode_id);
+  return inode_id_path.back();
 }
 
-void OutcpCommand::write_real_file(const std::string &path,
-                                   std::vector<uint8_t> &input) {
+void OutcpCommand::write_real_file(const std::string &path, int32_t inode_id) {
   failure_message_ = "PATH NOT FOUND (neexistuje cílová cesta)";
-  std::ofstream file(path, std::ios::binary);
-  if (!file) {
+  int file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (file < 0) {
     throw command_error("Cannot write into output file.");
   }
 
-  file.seekp(0, std::ios::beg);
-  file.write(reinterpret_cast<const char *>(input.data()),
-             static_cast<std::streamsize>(input.size()));
+  // runs of clusters go straight to the file, nothing is buffered whole
+  try {
+    fs_.file_copy_out(inode_id, file);
+  } catch (...) {
+    ::close(file);
+    throw;
+  }
 
-  file.close();
+  if (::close(file) != 0) {
+    throw command_error("Cannot write into output file.");
+  }
 }
 
 } // namespace jkfs
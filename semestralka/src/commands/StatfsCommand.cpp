@@ -19,8 +19,8 @@ void StatfsCommand::execute_inner(
   std::cout << sb << std::endl;
   fs_.print_usage_info(sb);
 
-  auto bitmapi = fs_.get_bitmap_idxs(sb.bitmapi_start_addr, sb.bitmapi_size);
-  auto bitmapd = fs_.get_bitmap_idxs(sb.bitmapd_start_addr, sb.bitmapd_size);
+  auto bitmapi = fs_.get_bitmapi_idxs();
+  auto bitmapd = fs_.get_bitmapd_idxs();
 
   std::cout << "Used inodes(" << bitmapi.size() << "/" << sb.inode_count
             << "): " << compress_ranges(bitmapi) << std::endl;
@@ -32,6 +32,21 @@ void StatfsCommand::execute_inner(
     dir_count += fs_.dir_is(inode_id);
   }
   std::cout << "Total number of directories: " << dir_count << std::endl;
+
+  // shared clusters are counted once physically, for every file logically
+  std::cout << "Used space: " << fs_.clusters_logical() * sb.cluster_size
+            << " B logical, " << bitmapd.size() * sb.cluster_size
+            << " B physical" << std::endl;
+
+  auto &cache = fs_.cache();
+  std::cout << "Cluster cache(" << cache.size() << "/" << cache.capacity()
+            << "): " << cache.hits() << " hits, " << cache.misses()
+            << " misses" << std::endl;
+
+  auto &dentries = fs_.dentries();
+  std::cout << "Dentry cache(" << dentries.size() << "/"
+            << dentries.capacity() << "): " << dentries.hits() << " hits, "
+            << dentries.misses() << " misses" << std::endl;
 }
 
 std::string StatfsCommand::compress_ranges(const std::vector<int32_t> &v) {
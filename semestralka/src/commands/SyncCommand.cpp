@@ -0,0 +1,20 @@
+#include <string>
+
+#include "commands.hpp"
+
+namespace jkfs {
+
+SyncCommand::SyncCommand() {
+  id_ = "sync";
+  name_ = "Synchronize";
+  desc_ = "Write all changes held in memory into the filesystem file and\n\
+| make them durable (fsync). Useful with --durability manual.";
+  how_ = "sync";
+}
+
+void SyncCommand::execute_inner(
+    [[maybe_unused]] const std::vector<std::string> &_) {
+  fs_.sync();
+}
+
+} // namespace jkfs
@@ -1,3 +1,6 @@
+#include <cstdint>
+#include <filesystem>
+#include <limits>
 #include <string>
 
 #include "commands.hpp"
@@ -47,16 +50,21 @@ void XcpCommand::execute_inner(const std::vector<std::string> &args) {
     target = target_path_i.back();
   }
 
-  // ready data
-  auto data = fs_.file_read(source_1);
-  auto data2 = fs_.file_read(source_2);
-  data.insert(data.end(), data2.begin(), data2.end());
+  // ready sizes
+  auto size_1 = static_cast<size_t>(fs_.inode_read(source_1).file_size);
+  auto size_2 = static_cast<size_t>(fs_.inode_read(source_2).file_size);
+  if (size_1 + size_2 >
+      static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+    throw command_error("the joined file would be too big");
+  }
 
   // something is on target path
+  std::string name = target_path.filename();
   if (target >= 0) {
     if (has_force_flag(args)) {
-      // have permission to kill
-      fs_.file_delete(target_parent, target_path.filename());
+      // have permission to kill, but target may be one of sources - it is
+      // replaced only when the new file is complete
+      name = free_name(target_parent);
     } else {
       if (fs_.vocal()) {
         std::cout << "The target file already exists. If you wish to "
@@ -70,10 +78,29 @@ void XcpCommand::execute_inner(const std::vector<std::string> &args) {
   }
 
   // create new file & copy contents
-  target =
-      fs_.file_create_sized(target_parent, target_path.filename(), data.size());
-  fs_.file_write(target, 0, reinterpret_cast<const char *>(data.data()),
-                 data.size());
+  auto created = fs_.file_create_sized(target_parent, name,
+                                       static_cast<int32_t>(size_1 + size_2));
+  try {
+    fs_.file_copy_range(source_1, 0, created, 0, size_1);
+    fs_.file_copy_range(source_2, 0, created, size_1, size_2);
+  } catch (...) {
+    fs_.file_delete(target_parent, name);
+    throw;
+  }
+
+  if (target >= 0) {
+    fs_.file_delete(target_parent, target_path.filename());
+    fs_.rename(target_parent, name, target_parent, target_path.filename());
+  }
+}
+
+std::string XcpCommand::free_name(int32_t parent) {
+  for (int i = 0;; i++) {
+    auto name = ".xcp" + std::to_string(i);
+    if (fs_.dir_lookup(parent, name) < 0) {
+      return name;
+    }
+  }
 }
 
 bool XcpCommand::has_force_flag(const std::vector<std::string> &args) const {
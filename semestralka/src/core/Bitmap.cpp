@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "Bitmap.hpp"
+#include "errors.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
+
+namespace jkfs {
+
+namespace {
+
+constexpr size_t WORD_BITS = 64;
+constexpr size_t WORD_BYTES = 8;
+
+// index of first word in [from, to) which isn't equal to pattern, or <to>
+using Skip_Kernel = size_t (*)(const uint64_t *words, size_t from, size_t to,
+                               uint64_t pattern);
+
+size_t skip_words_scalar(const uint64_t *words, size_t from, size_t to,
+                         uint64_t pattern) {
+  while (from < to && words[from] == pattern) {
+    from++;
+  }
+  return from;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+
+__attribute__((target("sse2"))) size_t
+skip_words_sse2(const uint64_t *words, size_t from, size_t to,
+                uint64_t pattern) {
+  const __m128i pat = _mm_set1_epi64x(static_cast<long long>(pattern));
+  // 2 words at a time, equal only if all 16 bytes are equal
+  while (from + 2 <= to) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + from));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, pat)) != 0xFFFF) {
+      break;
+    }
+    from += 2;
+  }
+  return skip_words_scalar(words, from, to, pattern);
+}
+
+__attribute__((target("avx2"))) size_t
+skip_words_avx2(const uint64_t *words, size_t from, size_t to,
+                uint64_t pattern) {
+  const __m256i pat = _mm256_set1_epi64x(static_cast<long long>(pattern));
+  // 4 words at a time
+  while (from + 4 <= to) {
+    auto v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + from));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(v, pat)) != -1) {
+      break;
+    }
+    from += 4;
+  }
+  return skip_words_scalar(words, from, to, pattern);
+}
+
+#endif
+
+// choose the best kernel the CPU supports, once
+Skip_Kernel pick_skip_kernel() {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return skip_words_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return skip_words_sse2;
+  }
+#endif
+  return skip_words_scalar;
+}
+
+const Skip_Kernel skip_words = pick_skip_kernel();
+
+// reverse bits in byte, used to convert MSB_FIRST to logical order & back
+uint8_t reverse(uint8_t byte) {
+  byte = static_cast<uint8_t>((byte & 0xF0) >> 4 | (byte & 0x0F) << 4);
+  byte = static_cast<uint8_t>((byte & 0xCC) >> 2 | (byte & 0x33) << 2);
+  byte = static_cast<uint8_t>((byte & 0xAA) >> 1 | (byte & 0x55) << 1);
+  return byte;
+}
+
+} // namespace
+
+Bitmap::Bitmap(Bit_Order order) : order_(order) {}
+
+void Bitmap::load(std::span<const uint8_t> bytes, size_t bits) {
+  if (bits > bytes.size() * 8) {
+    throw jkfilesystem_error("Bitmap cannot hold more bits than its bytes.");
+  }
+  reset(bits, bytes.size());
+
+  for (size_t i = 0; i < bytes.size(); i++) {
+    uint64_t byte = order_ == Bit_Order::LSB_FIRST ? bytes[i] : reverse(bytes[i]);
+    words_[i / WORD_BYTES] |= byte << (8 * (i % WORD_BYTES));
+  }
+
+  // padding bits on disk are not part of the bitmap
+  if (bits % WORD_BITS != 0) {
+    words_.back() &= (uint64_t{1} << (bits % WORD_BITS)) - 1;
+  }
+}
+
+void Bitmap::reset(size_t bits, size_t bytes) {
+  bits_ = bits;
+  bytes_ = bytes;
+  words_.assign((bytes + WORD_BYTES - 1) / WORD_BYTES, 0);
+  dirty_.assign((words_.size() + WORD_BITS - 1) / WORD_BITS, 0);
+  cursor_ = 0;
+  low_water_ = 0;
+}
+
+size_t Bitmap::size() const { return bits_; }
+
+bool Bitmap::get(size_t idx) const {
+  if (idx >= bits_) {
+    throw jkfilesystem_error("Bitmap index out of range.");
+  }
+  return (words_[idx / WORD_BITS] >> (idx % WORD_BITS)) & 1u;
+}
+
+void Bitmap::set(size_t idx) {
+  if (idx >= bits_) {
+    throw jkfilesystem_error("Bitmap index out of range.");
+  }
+  words_[idx / WORD_BITS] |= uint64_t{1} << (idx % WORD_BITS);
+  mark_dirty(idx / WORD_BITS);
+}
+
+void Bitmap::clear(size_t idx) {
+  if (idx >= bits_) {
+    throw jkfilesystem_error("Bitmap index out of range.");
+  }
+  words_[idx / WORD_BITS] &= ~(uint64_t{1} << (idx % WORD_BITS));
+  mark_dirty(idx / WORD_BITS);
+  low_water_ = std::min(low_water_, idx);
+}
+
+void Bitmap::set_range(size_t start, size_t count) {
+  assign_range(start, count, true);
+}
+
+void Bitmap::clear_range(size_t start, size_t count) {
+  assign_range(start, count, false);
+}
+
+int64_t Bitmap::find_first(bool value, size_t from) const {
+  if (from >= bits_) {
+    return -1;
+  }
+  // words without any wanted bit look like this
+  const uint64_t skip = value ? 0 : ~uint64_t{0};
+
+  size_t word = from / WORD_BITS;
+  // first word may be entered in the middle - ignore bits before <from>
+  uint64_t bits = (value ? words_[word] : ~words_[word]) &
+                  (~uint64_t{0} << (from % WORD_BITS));
+
+  while (bits == 0) {
+    word = skip_words(words_.data(), word + 1, words_.size(), skip);
+    if (word >= words_.size()) {
+      return -1;
+    }
+    bits = value ? words_[word] : ~words_[word];
+  }
+
+  size_t idx = word * WORD_BITS + static_cast<size_t>(std::countr_zero(bits));
+  // padding bits after the end look free, but aren't part of the bitmap
+  return idx < bits_ ? static_cast<int64_t>(idx) : -1;
+}
+
+int64_t Bitmap::find_run(size_t count, size_t hint) const {
+  if (count == 0 || count > bits_) {
+    return -1;
+  }
+  // nothing below low water is free
+  hint = hint < bits_ ? std::max(hint, low_water_) : low_water_;
+
+  // search [from, to) for a run starting before <to>
+  auto search = [this, count](size_t from, size_t to) -> int64_t {
+    while (from < to) {
+      auto start = find_first(false, from);
+      if (start < 0 || static_cast<size_t>(start) >= to) {
+        return -1;
+      }
+      auto end = find_first(true, static_cast<size_t>(start));
+      auto run_end = end < 0 ? bits_ : static_cast<size_t>(end);
+      if (run_end - static_cast<size_t>(start) >= count) {
+        return start;
+      }
+      from = run_end;
+    }
+    return -1;
+  };
+
+  auto found = search(hint, bits_);
+  if (found < 0 && hint > low_water_) {
+    found = search(low_water_, hint); // wrap around
+  }
+  return found;
+}
+
+int64_t Bitmap::find_next_free() {
+  size_t from = std::max(cursor_, low_water_);
+  auto idx = find_first(false, from);
+  if (idx < 0 && from > low_water_) {
+    // wrap around, but only to the lowest bit which may be free
+    from = low_water_;
+    idx = find_first(false, from);
+  }
+
+  // searched from low water - everything before the result is used
+  if (from == low_water_) {
+    low_water_ = idx < 0 ? bits_ : static_cast<size_t>(idx);
+  }
+  return idx;
+}
+
+size_t Bitmap::cursor() const { return cursor_; }
+
+void Bitmap::cursor(size_t idx) { cursor_ = idx < bits_ ? idx : 0; }
+
+std::vector<std::pair<size_t, size_t>> Bitmap::zero_runs() const {
+  std::vector<std::pair<size_t, size_t>> runs;
+  size_t from = low_water_;
+  while (from < bits_) {
+    auto start = find_first(false, from);
+    if (start < 0) {
+      break;
+    }
+    auto end = find_first(true, static_cast<size_t>(start));
+    auto run_end = end < 0 ? bits_ : static_cast<size_t>(end);
+    runs.emplace_back(static_cast<size_t>(start),
+                      run_end - static_cast<size_t>(start));
+    from = run_end;
+  }
+  return runs;
+}
+
+std::vector<int32_t> Bitmap::ones() const {
+  std::vector<int32_t> idxs;
+  for (size_t word = 0; word < words_.size(); word++) {
+    // take set bits one by one from the lowest
+    for (uint64_t bits = words_[word]; bits != 0; bits &= bits - 1) {
+      auto idx = word * WORD_BITS + static_cast<size_t>(std::countr_zero(bits));
+      if (idx < bits_) {
+        idxs.push_back(static_cast<int32_t>(idx));
+      }
+    }
+  }
+  return idxs;
+}
+
+uint8_t Bitmap::byte(size_t byte_idx) const {
+  auto byte = static_cast<uint8_t>(words_[byte_idx / WORD_BYTES] >>
+                                   (8 * (byte_idx % WORD_BYTES)));
+  return order_ == Bit_Order::LSB_FIRST ? byte : reverse(byte);
+}
+
+std::vector<std::pair<size_t, size_t>> Bitmap::dirty_ranges() const {
+  std::vector<std::pair<size_t, size_t>> ranges;
+
+  for (size_t word = 0; word < words_.size(); word++) {
+    if (!((dirty_[word / WORD_BITS] >> (word % WORD_BITS)) & 1u)) {
+      continue;
+    }
+    size_t start = word * WORD_BYTES;
+    size_t end = std::min(start + WORD_BYTES, bytes_);
+
+    // neighbouring dirty words are one range
+    if (!ranges.empty() && ranges.back().first + ranges.back().second == start) {
+      ranges.back().second += end - start;
+    } else {
+      ranges.push_back({start, end - start});
+    }
+  }
+
+  return ranges;
+}
+
+void Bitmap::clean() { dirty_.assign(dirty_.size(), 0); }
+
+// PRIVATE
+
+void Bitmap::mark_dirty(size_t word_idx) {
+  dirty_[word_idx / WORD_BITS] |= uint64_t{1} << (word_idx % WORD_BITS);
+}
+
+void Bitmap::assign_range(size_t start, size_t count, bool value) {
+  if (start > bits_ || count > bits_ - start) {
+    throw jkfilesystem_error("Bitmap range out of range.");
+  }
+
+  size_t idx = start;
+  size_t end = start + count;
+  while (idx < end) {
+    size_t word = idx / WORD_BITS;
+    size_t offset = idx % WORD_BITS;
+    size_t take = std::min(WORD_BITS - offset, end - idx);
+    // <take> ones shifted to <offset>, full word is special - shift by 64 is UB
+    uint64_t mask = take == WORD_BITS ? ~uint64_t{0}
+                                      : ((uint64_t{1} << take) - 1) << offset;
+    if (value) {
+      words_[word] |= mask;
+    } else {
+      words_[word] &= ~mask;
+    }
+    mark_dirty(word);
+    idx += take;
+  }
+
+  if (!value) {
+    low_water_ = std::min(low_water_, start);
+  }
+}
+
+} // namespace jkfs
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "ClusterCache.hpp"
+
+namespace jkfs {
+
+ClusterCache::ClusterCache(size_t capacity) : capacity_(capacity) {}
+
+bool ClusterCache::enabled() const { return capacity_ > 0; }
+
+size_t ClusterCache::capacity() const { return capacity_; }
+
+void ClusterCache::capacity(size_t capacity) {
+  capacity_ = capacity;
+  evict_until(capacity_);
+}
+
+void ClusterCache::write_back(Write_Back write_back) {
+  write_back_ = std::move(write_back);
+}
+
+std::vector<uint8_t> *ClusterCache::find(int32_t idx) {
+  auto it = entries_.find(idx);
+  if (it == entries_.end()) {
+    misses_++;
+    return nullptr;
+  }
+  hits_++;
+
+  // move to front
+  lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+  return &it->second.data;
+}
+
+std::vector<uint8_t> *ClusterCache::put(int32_t idx, std::vector<uint8_t> data,
+                                        bool dirty) {
+  if (!enabled()) {
+    if (dirty && write_back_) {
+      write_back_(idx, data);
+    }
+    return nullptr;
+  }
+
+  auto it = entries_.find(idx);
+  if (it != entries_.end()) {
+    it->second.data = std::move(data);
+    it->second.dirty = it->second.dirty || dirty;
+    lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+    return &it->second.data;
+  }
+
+  // make space for one more
+  evict_until(capacity_ - 1);
+
+  lru_.push_front(idx);
+  auto &entry = entries_[idx];
+  entry.data = std::move(data);
+  entry.dirty = dirty;
+  entry.lru_pos = lru_.begin();
+
+  return &entry.data;
+}
+
+bool ClusterCache::contains(int32_t idx) const {
+  return entries_.contains(idx);
+}
+
+void ClusterCache::mark_dirty(int32_t idx) {
+  auto it = entries_.find(idx);
+  if (it != entries_.end()) {
+    it->second.dirty = true;
+  }
+}
+
+void ClusterCache::erase(int32_t idx) {
+  auto it = entries_.find(idx);
+  if (it == entries_.end()) {
+    return;
+  }
+  lru_.erase(it->second.lru_pos);
+  entries_.erase(it);
+}
+
+void ClusterCache::flush() {
+  // write back in index order, so the device sees mostly sequential writes
+  std::vector<int32_t> dirty;
+  for (const auto &[idx, entry] : entries_) {
+    if (entry.dirty) {
+      dirty.push_back(idx);
+    }
+  }
+  std::sort(dirty.begin(), dirty.end());
+
+  for (const auto &idx : dirty) {
+    auto &entry = entries_.at(idx);
+    if (write_back_) {
+      write_back_(idx, entry.data);
+    }
+    entry.dirty = false;
+  }
+}
+
+void ClusterCache::clear() {
+  entries_.clear();
+  lru_.clear();
+}
+
+size_t ClusterCache::hits() const { return hits_; }
+size_t ClusterCache::misses() const { return misses_; }
+size_t ClusterCache::size() const { return entries_.size(); }
+
+// PRIVATE
+
+void ClusterCache::evict_until(size_t count) {
+  while (!lru_.empty() && entries_.size() > count) {
+    auto victim = lru_.back();
+    auto it = entries_.find(victim);
+    if (it->second.dirty && write_back_) {
+      write_back_(victim, it->second.data);
+    }
+    entries_.erase(it);
+    lru_.pop_back();
+  }
+}
+
+} // namespace jkfs
@@ -0,0 +1,114 @@
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <string>
+
+#include "DentryCache.hpp"
+
+namespace jkfs {
+
+size_t DentryCache::Key_Hash::operator()(const Key &key) const {
+  return std::hash<std::string>{}(key.second) ^
+         (std::hash<int32_t>{}(key.first) * 0x9e3779b97f4a7c15ull);
+}
+
+DentryCache::DentryCache(size_t capacity) : capacity_(capacity) {}
+
+bool DentryCache::enabled() const { return capacity_ > 0; }
+
+size_t DentryCache::capacity() const { return capacity_; }
+
+void DentryCache::capacity(size_t capacity) {
+  capacity_ = capacity;
+  evict_until(capacity_);
+}
+
+std::optional<int32_t> DentryCache::find(int32_t parent_id,
+                                         const std::string &name) {
+  auto it = entries_.find({parent_id, name});
+  if (it == entries_.end()) {
+    misses_++;
+    return std::nullopt;
+  }
+  hits_++;
+
+  // move to front
+  lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+  return it->second.child;
+}
+
+void DentryCache::put(int32_t parent_id, const std::string &name,
+                      int32_t child_id) {
+  if (!enabled()) {
+    return;
+  }
+
+  auto it = entries_.find({parent_id, name});
+  if (it != entries_.end()) {
+    it->second.child = child_id;
+    lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+    return;
+  }
+
+  // make space for one more
+  evict_until(capacity_ - 1);
+
+  lru_.emplace_front(parent_id, name);
+  auto &entry = entries_[lru_.front()];
+  entry.child = child_id;
+  entry.lru_pos = lru_.begin();
+  parents_[parent_id]++;
+}
+
+void DentryCache::erase(int32_t parent_id, const std::string &name) {
+  auto it = entries_.find({parent_id, name});
+  if (it != entries_.end()) {
+    remove(it);
+  }
+}
+
+void DentryCache::erase_parent(int32_t parent_id) {
+  if (!parents_.contains(parent_id)) {
+    return;
+  }
+
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    auto next = std::next(it);
+    if (it->first.first == parent_id) {
+      remove(it);
+    }
+    it = next;
+  }
+}
+
+void DentryCache::clear() {
+  entries_.clear();
+  lru_.clear();
+  parents_.clear();
+}
+
+size_t DentryCache::hits() const { return hits_; }
+size_t DentryCache::misses() const { return misses_; }
+size_t DentryCache::size() const { return entries_.size(); }
+
+// PRIVATE
+
+void DentryCache::evict_until(size_t count) {
+  while (!lru_.empty() && entries_.size() > count) {
+    remove(entries_.find(lru_.back()));
+  }
+}
+
+void DentryCache::remove(
+    std::unordered_map<Key, Entry, Key_Hash>::iterator it) {
+  auto parent = parents_.find(it->first.first);
+  if (--parent->second == 0) {
+    parents_.erase(parent);
+  }
+  lru_.erase(it->second.lru_pos);
+  entries_.erase(it);
+}
+
+} // namespace jkfs
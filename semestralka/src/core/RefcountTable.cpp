@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "RefcountTable.hpp"
+#include "errors.hpp"
+
+namespace jkfs {
+
+namespace {
+
+constexpr size_t WORD_BITS = 64;
+constexpr size_t BLOCK = 32; // entries per dirty bit
+
+} // namespace
+
+void RefcountTable::load(std::span<const uint8_t> bytes, size_t count) {
+  if (count * ENTRY_SIZE > bytes.size()) {
+    throw jkfilesystem_error("Refcount table cannot hold more entries than its "
+                             "bytes.");
+  }
+  reset(count);
+
+  for (size_t i = 0; i < count; i++) {
+    counts_[i] = static_cast<uint16_t>(bytes[2 * i] | (bytes[2 * i + 1] << 8));
+    if (counts_[i] > 0) {
+      shared_++;
+      extra_ += counts_[i];
+    }
+  }
+}
+
+void RefcountTable::reset(size_t count) {
+  counts_.assign(count, 0);
+  auto blocks = (count + BLOCK - 1) / BLOCK;
+  dirty_.assign((blocks + WORD_BITS - 1) / WORD_BITS, 0);
+  shared_ = 0;
+  extra_ = 0;
+}
+
+size_t RefcountTable::size() const { return counts_.size(); }
+
+uint16_t RefcountTable::get(size_t idx) const {
+  if (idx >= counts_.size()) {
+    throw jkfilesystem_error("Refcount index out of range.");
+  }
+  return counts_[idx];
+}
+
+void RefcountTable::share(size_t idx) {
+  if (idx >= counts_.size()) {
+    throw jkfilesystem_error("Refcount index out of range.");
+  }
+  if (counts_[idx] == std::numeric_limits<uint16_t>::max()) {
+    throw jkfilesystem_error("Cluster " + std::to_string(idx) +
+                             " is shared too many times.");
+  }
+
+  shared_ += counts_[idx] == 0;
+  counts_[idx]++;
+  extra_++;
+  mark_dirty(idx);
+}
+
+bool RefcountTable::release(size_t idx) {
+  if (idx >= counts_.size() || counts_[idx] == 0) {
+    return false;
+  }
+
+  counts_[idx]--;
+  shared_ -= counts_[idx] == 0;
+  extra_--;
+  mark_dirty(idx);
+  return true;
+}
+
+size_t RefcountTable::shared() const { return shared_; }
+
+size_t RefcountTable::extra() const { return extra_; }
+
+uint8_t RefcountTable::byte(size_t byte_idx) const {
+  auto entry = counts_[byte_idx / ENTRY_SIZE];
+  return static_cast<uint8_t>(byte_idx % ENTRY_SIZE == 0 ? entry : entry >> 8);
+}
+
+std::vector<std::pair<size_t, size_t>> RefcountTable::dirty_ranges() const {
+  std::vector<std::pair<size_t, size_t>> ranges;
+
+  auto blocks = (counts_.size() + BLOCK - 1) / BLOCK;
+  for (size_t block = 0; block < blocks; block++) {
+    if (!((dirty_[block / WORD_BITS] >> (block % WORD_BITS)) & 1u)) {
+      continue;
+    }
+    size_t start = block * BLOCK * ENTRY_SIZE;
+    size_t end = std::min(start + BLOCK * ENTRY_SIZE,
+                          counts_.size() * ENTRY_SIZE);
+
+    // neighbouring dirty blocks are one range
+    if (!ranges.empty() &&
+        ranges.back().first + ranges.back().second == start) {
+      ranges.back().second += end - start;
+    } else {
+      ranges.push_back({start, end - start});
+    }
+  }
+
+  return ranges;
+}
+
+void RefcountTable::clean() { dirty_.assign(dirty_.size(), 0); }
+
+// PRIVATE
+
+void RefcountTable::mark_dirty(size_t idx) {
+  auto block = idx / BLOCK;
+  dirty_[block / WORD_BITS] |= uint64_t{1} << (block % WORD_BITS);
+}
+
+} // namespace jkfs
@@ -1,4 +1,5 @@
 #include "structures.hpp"
+#include <cstddef>
 #include <iterator>
 #include <ostream>
 #include <string>
@@ -10,6 +11,7 @@ std::ostream &operator<<(std::ostream &os, const superblock &sb) {
 
   os << "superblock{\n"
      << "  signature: \"" << sig << "\",\n"
+     << "  version: " << sb.version << ",\n"
      << "  disk_size: " << sb.disk_size << ",\n"
      << "  cluster_size: " << sb.cluster_size << ",\n"
      << "  cluster_count: " << sb.cluster_count << ",\n"
@@ -18,11 +20,20 @@ std::ostream &operator<<(std::ostream &os, const superblock &sb) {
      << "  bitmapi_start_addr: " << sb.bitmapi_start_addr << ",\n"
      << "  bitmapd_start_addr: " << sb.bitmapd_start_addr << ",\n"
      << "  inode_start_addr: " << sb.inode_start_addr << ",\n"
-     << "  data_start_addr: " << sb.data_start_addr << "\n"
-     << "}";
+     << "  data_start_addr: " << sb.data_start_addr;
+  if (sb.version >= superblock::VERSION_REFLINK) {
+    os << ",\n  refcount_start_addr: " << sb.refcount_start_addr << ",\n"
+       << "  refcount_size: " << sb.refcount_size;
+  }
+  os << "\n}";
   return os;
 }
 
+size_t superblock::stored_size() const {
+  return version >= VERSION_REFLINK ? sizeof(superblock)
+                                    : offsetof(superblock, refcount_start_addr);
+}
+
 std::ostream &operator<<(std::ostream &os, const inode &i) {
   os << "inode{\n"
      << " node_id=" << i.node_id
@@ -54,6 +65,20 @@ void inode::copy_from(const inode &o) {
   indirect2 = o.indirect2;
 }
 
+// extent i is made of slots 2i & 2i+1 of direct[0..4], indirect1
+struct extent inode::extent(size_t idx) const {
+  const int32_t *slots[] = {&direct[0], &direct[1], &direct[2],
+                            &direct[3], &direct[4], &indirect1};
+  return {*slots[2 * idx], *slots[2 * idx + 1]};
+}
+
+void inode::extent(size_t idx, const struct extent &e) {
+  int32_t *slots[] = {&direct[0], &direct[1], &direct[2],
+                      &direct[3], &direct[4], &indirect1};
+  *slots[2 * idx] = e.start;
+  *slots[2 * idx + 1] = e.length;
+}
+
 bool dir_item::name_matches(const std::string &other_name) const {
   std::string_view stored(item_name.data(),
                           std::char_traits<char>::length(item_name.data()));
@@ -61,10 +86,23 @@ bool dir_item::name_matches(const std::string &other_name) const {
   return stored == other_name;
 }
 
+std::string_view dir_item::name() const {
+  return {item_name.data(), std::char_traits<char>::length(item_name.data())};
+}
+
 bool dir_item::empty() const { return item_name[0] == '\0'; }
 
 bool dir_item::operator<(const dir_item &other) const {
-  return std::string(item_name.data()) < std::string(other.item_name.data());
+  return name() < other.name();
+}
+
+bool dir_tree::valid() const {
+  return magic == MAGIC && no_name == '\0' && root > 0 && items >= 0;
+}
+
+bool dir_index::valid() const {
+  return magic == MAGIC && no_name == '\0' && buckets > 0 &&
+         (buckets & (buckets - 1)) == 0;
 }
 
 } // namespace jkfs
@@ -0,0 +1,92 @@
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "devices.hpp"
+#include "errors.hpp"
+
+namespace jkfs {
+
+MmapDevice::MmapDevice(const std::string &path) : path_(path) { map(); }
+
+MmapDevice::~MmapDevice() { unmap(); }
+
+void MmapDevice::map() {
+  std::error_code ec;
+  auto size = std::filesystem::file_size(path_, ec);
+  if (ec || size == 0) {
+    return; // cannot map empty file, reads will be out of bounds
+  }
+
+  int fd = ::open(path_.c_str(), O_RDWR);
+  if (fd < 0) {
+    throw jkfilesystem_error("Cannot open file for mapping: " + name());
+  }
+  void *addr = ::mmap(nullptr, static_cast<size_t>(size),
+                      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd); // mapping holds its own reference
+
+  if (addr == MAP_FAILED) {
+    throw jkfilesystem_error("Cannot map file: " + name());
+  }
+  map_ = static_cast<uint8_t *>(addr);
+  size_ = static_cast<size_t>(size);
+}
+
+void MmapDevice::unmap() {
+  if (map_ == nullptr) {
+    return;
+  }
+  ::munmap(map_, size_);
+  map_ = nullptr;
+  size_ = 0;
+}
+
+void MmapDevice::read(size_t offset, void *data, size_t count) {
+  check_bounds(offset, count);
+  std::memcpy(data, map_ + offset, count);
+}
+
+void MmapDevice::write(size_t offset, const void *data, size_t count) {
+  check_bounds(offset, count);
+  std::memcpy(map_ + offset, data, count);
+}
+
+void MmapDevice::flush() {
+  // MAP_SHARED - every write is already visible in the file
+}
+
+void MmapDevice::sync() {
+  if (map_ != nullptr && ::msync(map_, size_, MS_SYNC) != 0) {
+    throw jkfilesystem_error("Cannot sync mapping of " + name() + ".");
+  }
+}
+
+void MmapDevice::resize(size_t size) {
+  // never change size of the file under a live mapping
+  unmap();
+
+  int fd = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    throw jkfilesystem_error("Cannot create file " + name() + ".");
+  }
+  auto res = ::ftruncate(fd, static_cast<off_t>(size));
+  ::close(fd);
+  if (res != 0) {
+    throw jkfilesystem_error("Cannot resize file " + name() + ".");
+  }
+
+  map();
+}
+
+size_t MmapDevice::size() const { return size_; }
+
+uint8_t *MmapDevice::data() { return map_; }
+
+std::string MmapDevice::name() const { return path_.string(); }
+
+} // namespace jkfs
@@ -0,0 +1,152 @@
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "devices.hpp"
+#include "errors.hpp"
+
+namespace jkfs {
+
+// copy between two files inside the kernel, return how many bytes were copied
+// (less than count when neither copy_file_range nor sendfile can go on)
+static size_t kernel_copy(int in, size_t in_offset, int out, size_t out_offset,
+                          size_t count) {
+  size_t done = 0;
+  bool range = true; // copy_file_range works for these files
+
+  while (done < count) {
+    auto in_off = static_cast<off_t>(in_offset + done);
+    ssize_t n = 0;
+    if (range) {
+      auto out_off = static_cast<off_t>(out_offset + done);
+      n = ::copy_file_range(in, &in_off, out, &out_off, count - done, 0);
+      if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                    errno == EOPNOTSUPP)) {
+        range = false;
+        continue;
+      }
+    } else {
+      // sendfile writes at the current position of out
+      if (::lseek(out, static_cast<off_t>(out_offset + done), SEEK_SET) < 0) {
+        break;
+      }
+      n = ::sendfile(out, in, &in_off, count - done);
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += static_cast<size_t>(n);
+  }
+
+  return done;
+}
+
+PosixDevice::PosixDevice(const std::string &path) : path_(path) { open(); }
+
+PosixDevice::~PosixDevice() { close(); }
+
+void PosixDevice::open() {
+  close();
+  fd_ = ::open(path_.c_str(), O_RDWR);
+
+  struct stat st{};
+  if (fd_ >= 0 && ::fstat(fd_, &st) == 0) {
+    size_ = static_cast<size_t>(st.st_size);
+  }
+}
+
+void PosixDevice::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  size_ = 0;
+}
+
+void PosixDevice::read(size_t offset, void *data, size_t count) {
+  check_bounds(offset, count);
+
+  auto *dst = static_cast<char *>(data);
+  while (count > 0) {
+    auto n = ::pread(fd_, dst, count, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw jkfilesystem_error("Cannot read from file " + name() + ": " +
+                               std::strerror(errno));
+    }
+    dst += n;
+    offset += static_cast<size_t>(n);
+    count -= static_cast<size_t>(n);
+  }
+}
+
+void PosixDevice::write(size_t offset, const void *data, size_t count) {
+  check_bounds(offset, count);
+
+  const auto *src = static_cast<const char *>(data);
+  while (count > 0) {
+    auto n = ::pwrite(fd_, src, count, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw jkfilesystem_error("Cannot write into file " + name() + ": " +
+                               std::strerror(errno));
+    }
+    src += n;
+    offset += static_cast<size_t>(n);
+    count -= static_cast<size_t>(n);
+  }
+}
+
+void PosixDevice::flush() {
+  // nothing is buffered in user space
+}
+
+void PosixDevice::sync() {
+  if (fd_ >= 0 && ::fsync(fd_) != 0) {
+    throw jkfilesystem_error("Cannot sync file " + name() + ".");
+  }
+}
+
+void PosixDevice::resize(size_t size) {
+  if (fd_ < 0) {
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      throw jkfilesystem_error("Cannot create file " + name() + ".");
+    }
+  }
+  if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+    throw jkfilesystem_error("Cannot resize file " + name() + ".");
+  }
+  size_ = size;
+}
+
+size_t PosixDevice::size() const { return size_; }
+
+size_t PosixDevice::copy_to_fd(size_t offset, int fd, size_t fd_offset,
+                               size_t count) {
+  check_bounds(offset, count);
+  return kernel_copy(fd_, offset, fd, fd_offset, count);
+}
+
+size_t PosixDevice::copy_from_fd(int fd, size_t fd_offset, size_t offset,
+                                 size_t count) {
+  check_bounds(offset, count);
+  return kernel_copy(fd, fd_offset, fd_, offset, count);
+}
+
+std::string PosixDevice::name() const { return path_.string(); }
+
+} // namespace jkfs
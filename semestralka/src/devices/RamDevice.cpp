@@ -0,0 +1,34 @@
+#include <cstring>
+#include <string>
+
+#include "devices.hpp"
+
+namespace jkfs {
+
+void RamDevice::read(size_t offset, void *data, size_t count) {
+  check_bounds(offset, count);
+  std::memcpy(data, bytes_.data() + offset, count);
+}
+
+void RamDevice::write(size_t offset, const void *data, size_t count) {
+  check_bounds(offset, count);
+  std::memcpy(bytes_.data() + offset, data, count);
+}
+
+void RamDevice::flush() {
+  // nowhere to flush to
+}
+
+void RamDevice::sync() {
+  // nothing is persisted
+}
+
+void RamDevice::resize(size_t size) { bytes_.resize(size, 0); }
+
+size_t RamDevice::size() const { return bytes_.size(); }
+
+uint8_t *RamDevice::data() { return bytes_.empty() ? nullptr : bytes_.data(); }
+
+std::string RamDevice::name() const { return "<RAM>"; }
+
+} // namespace jkfs
@@ -0,0 +1,83 @@
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "devices.hpp"
+#include "errors.hpp"
+
+namespace jkfs {
+
+StreamDevice::StreamDevice(const std::string &path) : path_(path) { open(); }
+
+void StreamDevice::open() {
+  file_.close();
+  file_ = std::fstream(path_, std::ios::binary | std::ios::in | std::ios::out);
+
+  std::error_code ec;
+  auto size = std::filesystem::file_size(path_, ec);
+  size_ = ec ? 0 : static_cast<size_t>(size);
+}
+
+void StreamDevice::read(size_t offset, void *data, size_t count) {
+  check_bounds(offset, count);
+
+  file_.clear();
+
+  file_.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+  file_.read(static_cast<char *>(data), static_cast<std::streamsize>(count));
+
+  if (!file_) {
+    throw jkfilesystem_error("Cannot read from file " + name() + ".");
+  }
+}
+
+void StreamDevice::write(size_t offset, const void *data, size_t count) {
+  check_bounds(offset, count);
+
+  file_.clear();
+
+  file_.seekp(static_cast<std::streamoff>(offset), std::ios::beg);
+  file_.write(static_cast<const char *>(data),
+              static_cast<std::streamsize>(count));
+
+  if (!file_) {
+    throw jkfilesystem_error("Cannot write into file " + name() + ".");
+  }
+}
+
+void StreamDevice::flush() { file_.flush(); }
+
+void StreamDevice::sync() {
+  flush();
+
+  // stream doesn't expose its descriptor, fsync on any descriptor of the same
+  // file is enough
+  int fd = ::open(path_.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return; // nothing was ever created
+  }
+  auto res = ::fsync(fd);
+  ::close(fd);
+  if (res != 0) {
+    throw jkfilesystem_error("Cannot sync file " + name() + ".");
+  }
+}
+
+void StreamDevice::resize(size_t size) {
+  file_.close();
+  if (!std::filesystem::exists(path_)) {
+    std::ofstream o(path_);
+  }
+  std::filesystem::resize_file(path_, static_cast<uintmax_t>(size));
+  open();
+}
+
+size_t StreamDevice::size() const { return size_; }
+
+std::string StreamDevice::name() const { return path_.string(); }
+
+} // namespace jkfs
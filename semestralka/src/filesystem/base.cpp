@@ -5,13 +5,13 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
-#include <filesystem>
-#include <fstream>
-#include <ios>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace jkfs {
@@ -21,12 +21,17 @@ Filesystem *Filesystem::instance_{nullptr};
 std::mutex Filesystem::mutex_;
 
 // ===== singleton behaviour =====
-Filesystem::Filesystem(const std::string &filename) { path(filename); }
+Filesystem::Filesystem(std::unique_ptr<IBlockDevice> device)
+    : device_(std::move(device)) {
+  cache_.write_back([this](int32_t idx, const std::vector<uint8_t> &data) {
+    cluster_store(idx, data);
+  });
+}
 
-Filesystem &Filesystem::instance(const std::string &filename) {
+Filesystem &Filesystem::instance(std::unique_ptr<IBlockDevice> device) {
   std::lock_guard<std::mutex> lock(mutex_);
   if (instance_ == nullptr) {
-    instance_ = new Filesystem(filename);
+    instance_ = new Filesystem(std::move(device));
   }
   return *instance_;
 }
@@ -45,22 +50,72 @@ Filesystem &Filesystem::instance() {
 bool Filesystem::vocal() const { return vocal_; }
 void Filesystem::vocal(bool vocal) { vocal_ = vocal; }
 
-std::string Filesystem::path() const { return path_; }
-void Filesystem::path(const std::string &path) {
-  path_ = path;
-  file_.close();
-  file_ = std::fstream(path_, std::ios::binary | std::ios::in | std::ios::out);
+Durability Filesystem::durability() const { return durability_; }
+void Filesystem::durability(Durability durability) {
+  durability_ = durability;
+  // nothing written before may stay behind the new policy
+  flush();
+}
+
+bool Filesystem::secure_zero() const { return secure_zero_; }
+void Filesystem::secure_zero(bool secure_zero) { secure_zero_ = secure_zero; }
+
+int32_t Filesystem::format_version() const { return format_version_; }
+void Filesystem::format_version(int32_t version) {
+  if (version < superblock::VERSION_LEGACY ||
+      version > superblock::VERSION_CURRENT) {
+    throw jkfilesystem_error("Unknown format version " +
+                             std::to_string(version) + ".");
+  }
+  format_version_ = version;
+}
+
+size_t Filesystem::stream_chunk() const { return stream_chunk_; }
+void Filesystem::stream_chunk(size_t bytes) {
+  if (bytes == 0) {
+    throw jkfilesystem_error("Stream chunk must not be empty.");
+  }
+  stream_chunk_ = bytes;
 }
 
-std::fstream &Filesystem::file() { return file_; }
+std::string Filesystem::path() const { return device_->name(); }
+
+IBlockDevice &Filesystem::device() { return *device_; }
+
+ClusterCache &Filesystem::cache() { return cache_; }
+
+DentryCache &Filesystem::dentries() { return dentries_; }
 
 struct superblock Filesystem::superblock() {
-  return read<struct superblock>(0);
+  if (!mounted_) {
+    mount();
+  }
+  return sb_;
 }
 
 void Filesystem::superblock(const struct superblock &sb) {
-  write<struct superblock>(sb, 0);
+  // older versions end before refcount fields, don't overwrite the bitmap
+  write_bytes(reinterpret_cast<const char *>(&sb), sb.stored_size(), 0);
   clear_bitmaps(sb);
+
+  sb_ = sb;
+  mounted_ = true;
+}
+
+bool Filesystem::uses_extents() {
+  return superblock().version >= superblock::VERSION_EXTENTS;
+}
+
+bool Filesystem::uses_refcounts() {
+  return superblock().version >= superblock::VERSION_REFLINK;
+}
+
+bool Filesystem::uses_dir_index() {
+  return superblock().version >= superblock::VERSION_DIR_INDEX;
+}
+
+bool Filesystem::uses_dir_tree() {
+  return superblock().version >= superblock::VERSION_DIR_TREE;
 }
 
 // insider knowledge - roots inode ID is always 0
@@ -116,115 +171,192 @@ void Filesystem::current_directory(const std::string &path) {
 
 // ===== methods =====
 
-std::vector<int32_t> Filesystem::get_bitmap_idxs(int32_t start_addr,
-                                                 size_t bytes_count) {
-  auto bytes = read_bytes(bytes_count, start_addr);
-  std::vector<int32_t> idxs;
+void Filesystem::mount() {
+  auto sb = read<struct superblock>(0);
+  if (sb.version < superblock::VERSION_REFLINK) {
+    // bytes after older superblock belong to the bitmap
+    sb.refcount_start_addr = 0;
+    sb.refcount_size = 0;
+  }
 
-  for (int i = 0; i < bytes.size(); i++) {
-    auto byte = bytes[i];
-    for (int j = 0; j < 8; j++) {
-      if (bit_get(byte, j)) {
-        idxs.push_back(i * 8 + j);
-      }
-    }
+  // validate - better refuse to mount than to compute garbage offsets
+  std::string_view sig(sb.signature,
+                       strnlen(sb.signature, superblock::MAX_SIGN_LEN));
+  if (sig != SIGNATURE) {
+    throw jkfilesystem_error("Device " + path() +
+                             " is not formatted (wrong signature).");
+  }
+  if (sb.version > superblock::VERSION_CURRENT) {
+    throw jkfilesystem_error("Device " + path() + " has unsupported version " +
+                             std::to_string(sb.version) + ".");
+  }
+  if (sb.cluster_size <= 0 || sb.cluster_count <= 0 || sb.inode_size <= 0 ||
+      sb.inode_count <= 0) {
+    throw jkfilesystem_error("Superblock is corrupted (invalid counts).");
+  }
+  auto data_end = static_cast<int64_t>(sb.data_start_addr) +
+                  static_cast<int64_t>(sb.cluster_count) * sb.cluster_size;
+  if (data_end > sb.disk_size) {
+    throw jkfilesystem_error("Superblock is corrupted (data out of disk).");
+  }
+  if (sb.refcount_size > 0 &&
+      (static_cast<int64_t>(sb.refcount_size) <
+           static_cast<int64_t>(sb.cluster_count) *
+               static_cast<int64_t>(RefcountTable::ENTRY_SIZE) ||
+       static_cast<int64_t>(sb.refcount_start_addr) + sb.refcount_size >
+           sb.disk_size)) {
+    throw jkfilesystem_error("Superblock is corrupted (invalid refcounts).");
   }
 
-  return idxs;
-}
+  bitmapi_.load(read_bytes(static_cast<size_t>(sb.bitmapi_size),
+                           static_cast<size_t>(sb.bitmapi_start_addr)),
+                static_cast<size_t>(sb.inode_count));
+  bitmapd_.load(read_bytes(static_cast<size_t>(sb.bitmapd_size),
+                           static_cast<size_t>(sb.bitmapd_start_addr)),
+                static_cast<size_t>(sb.cluster_count));
+  if (sb.refcount_size > 0) {
+    refcounts_.load(read_bytes(static_cast<size_t>(sb.refcount_size),
+                               static_cast<size_t>(sb.refcount_start_addr)),
+                    static_cast<size_t>(sb.cluster_count));
+  } else {
+    refcounts_.reset(0);
+  }
 
-// ===== private methods =====
+  sb_ = sb;
+  mounted_ = true;
+}
 
-void Filesystem::write_bytes(const char *data, size_t count,
-                             std::streamoff offset,
-                             std::ios_base::seekdir way) {
-  file_.clear();
+void Filesystem::unmount() {
+  mounted_ = false;
+  sb_ = {};
+  unwritten_.clear();
+  block_maps_.clear();
+  dentries_.clear();
+  dir_holes_.clear();
+  bitmapi_.reset(0, 0);
+  bitmapd_.reset(0, 0);
+  refcounts_.reset(0);
+}
 
-  file_.seekp(offset, way);
-  file_.write(data, static_cast<std::streamsize>(count));
+bool Filesystem::mounted() const { return mounted_; }
 
-  if (!file_) {
-    throw jkfilesystem_error("Cannot write bytes into file.");
+void Filesystem::flush() {
+  // allocated but never written clusters must not expose old data on device
+  std::vector<int32_t> unwritten(unwritten_.begin(), unwritten_.end());
+  std::ranges::sort(unwritten);
+  for (const auto &idx : unwritten) {
+    cluster_write(idx, nullptr, 0);
   }
 
-  file_.flush();
+  cache_.flush();
+  if (mounted_) {
+    bitmaps_store();
+  }
+  device_->flush();
 }
 
-std::vector<uint8_t> Filesystem::read_bytes(size_t count, std::streamoff offset,
-                                            std::ios_base::seekdir way) {
-  std::vector<uint8_t> buf(count);
-  file_.clear();
-
-  file_.seekg(offset, way);
-  file_.read(reinterpret_cast<char *>(buf.data()),
-             static_cast<std::streamsize>(count));
+void Filesystem::sync() {
+  flush();
+  device_->sync();
+}
 
-  if (!file_) {
-    throw jkfilesystem_error("Cannot read bytes from file.");
+void Filesystem::end_command() {
+  if (durability_ == Durability::BATCH) {
+    flush();
   }
+}
 
-  return buf;
+std::vector<int32_t> Filesystem::get_bitmapi_idxs() {
+  superblock(); // ensure mounted
+  return bitmapi_.ones();
 }
 
-bool Filesystem::bit_get(uint8_t byte, uint32_t bit_index) {
-  switch (BIT_ORDER) {
-  case Bit_Order::LSB_FIRST:
-    return (byte >> bit_index) & 1u;
-  case Bit_Order::MSB_FIRST:
-    return (byte >> (7 - bit_index)) & 1u;
-  default:
-    throw jkfilesystem_error("Unknown bit order.");
-  }
+std::vector<int32_t> Filesystem::get_bitmapd_idxs() {
+  superblock(); // ensure mounted
+  return bitmapd_.ones();
+}
+
+size_t Filesystem::clusters_logical() {
+  superblock(); // ensure mounted
+  return bitmapd_.ones().size() + refcounts_.extra();
 }
 
-void Filesystem::bit_set(uint8_t &byte, uint32_t bit_index) {
-  uint8_t mask;
+// ===== private methods =====
 
-  switch (BIT_ORDER) {
-  case Bit_Order::LSB_FIRST:
-    mask = static_cast<uint8_t>(1u << bit_index);
-    break;
-  case Bit_Order::MSB_FIRST:
-    mask = static_cast<uint8_t>(1u << (7 - bit_index));
-    break;
-  default:
-    throw jkfilesystem_error("Unknown bit order.");
+void Filesystem::write_done() {
+  if (durability_ == Durability::ALWAYS) {
+    device_->flush();
   }
+}
 
-  byte |= mask;
+void Filesystem::write_bytes(const char *data, size_t count, size_t offset) {
+  device_->write(offset, data, count);
+  write_done();
 }
 
-void Filesystem::bit_clear(uint8_t &byte, uint32_t bit_index) {
-  uint8_t mask;
+std::vector<uint8_t> Filesystem::read_bytes(size_t count, size_t offset) {
+  std::vector<uint8_t> buf(count);
+  device_->read(offset, buf.data(), count);
+  return buf;
+}
 
-  switch (BIT_ORDER) {
-  case Bit_Order::LSB_FIRST:
-    mask = static_cast<uint8_t>(~(1u << bit_index));
-    break;
-  case Bit_Order::MSB_FIRST:
-    mask = static_cast<uint8_t>(~(1u << (7 - bit_index)));
-    break;
-  default:
-    throw jkfilesystem_error("Unknown bit order.");
+void Filesystem::bitmap_mark(Bitmap &bitmap, int32_t idx, bool used) {
+  if (used) {
+    bitmap.set(static_cast<size_t>(idx));
+  } else {
+    bitmap.clear(static_cast<size_t>(idx));
   }
 
-  byte &= mask;
+  if (durability_ == Durability::ALWAYS) {
+    bitmaps_store();
+  }
 }
 
-int32_t Filesystem::get_first_bit(std::vector<uint8_t> &vec, bool value) {
-  // walk all bytes
-  for (size_t byte_idx = 0; byte_idx < vec.size(); byte_idx++) {
-    uint8_t byte = vec[byte_idx];
+void Filesystem::bitmap_mark(Bitmap &bitmap, int32_t start, size_t count,
+                             bool used) {
+  if (used) {
+    bitmap.set_range(static_cast<size_t>(start), count);
+  } else {
+    bitmap.clear_range(static_cast<size_t>(start), count);
+  }
+
+  if (durability_ == Durability::ALWAYS) {
+    bitmaps_store();
+  }
+}
 
-    // walk all bits left to right
-    // its only logical order, the physical is in bit_get
-    for (int logical_bit = 0; logical_bit < 8; logical_bit++) {
-      if (bit_get(byte, static_cast<uint8_t>(logical_bit)) == value) {
-        return static_cast<int32_t>(byte_idx) * 8 + logical_bit;
+void Filesystem::bitmaps_store() {
+  auto store = [this](Bitmap &bitmap, int32_t start_addr) {
+    for (const auto &[start, count] : bitmap.dirty_ranges()) {
+      std::vector<char> bytes(count);
+      for (size_t i = 0; i < count; i++) {
+        bytes[i] = static_cast<char>(bitmap.byte(start + i));
       }
+      write_bytes(bytes.data(), count, static_cast<size_t>(start_addr) + start);
     }
+    bitmap.clean();
+  };
+
+  store(bitmapi_, sb_.bitmapi_start_addr);
+  store(bitmapd_, sb_.bitmapd_start_addr);
+
+  for (const auto &[start, count] : refcounts_.dirty_ranges()) {
+    std::vector<char> bytes(count);
+    for (size_t i = 0; i < count; i++) {
+      bytes[i] = static_cast<char>(refcounts_.byte(start + i));
+    }
+    write_bytes(bytes.data(), count,
+                static_cast<size_t>(sb_.refcount_start_addr) + start);
+  }
+  refcounts_.clean();
+}
+
+void Filesystem::cluster_share(int32_t idx) {
+  refcounts_.share(static_cast<size_t>(idx));
+
+  if (durability_ == Durability::ALWAYS) {
+    bitmaps_store();
   }
-  return -1;
 }
 
 } // namespace jkfs
@@ -3,11 +3,19 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstring>
+#include <span>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace jkfs {
 
 std::vector<uint8_t> Filesystem::cluster_read(int32_t idx) {
+  auto view = cluster_view(idx);
+  return {view.begin(), view.end()};
+}
+
+std::span<const uint8_t> Filesystem::cluster_view(int32_t idx) {
   if (idx < 0) {
     throw jkfilesystem_error(
         "Clusters are indexed from 0 upwards, but you tried " +
@@ -20,27 +28,124 @@ std::vector<uint8_t> Filesystem::cluster_read(int32_t idx) {
                              ", but you tried " + std::to_string(idx));
   }
   auto offset = sb.data_start_addr + idx * sb.cluster_size;
+  auto size = static_cast<size_t>(sb.cluster_size);
+
+  if (unwritten_.contains(idx)) {
+    view_buffer_.assign(size, 0);
+    return view_buffer_;
+  }
 
-  return read_bytes(static_cast<size_t>(sb.cluster_size), offset);
+  if (!cluster_cached()) {
+    if (device_->data() != nullptr) {
+      return {device_->data() + offset, size};
+    }
+    view_buffer_ = read_bytes(size, offset);
+    return view_buffer_;
+  }
+
+  if (auto *cached = cache_.find(idx)) {
+    return *cached;
+  }
+  return *cache_.put(idx, read_bytes(size, offset), false);
 }
 
 int32_t Filesystem::cluster_alloc() {
-  auto sb = superblock();
-  auto buf =
-      read_bytes(static_cast<size_t>(sb.bitmapd_size), sb.bitmapd_start_addr);
+  superblock(); // ensure bitmaps are loaded
 
   // find
-  auto idx = get_first_bit(buf, 0);
+  auto idx = static_cast<int32_t>(bitmapd_.find_next_free());
   if (idx < 0) {
     return -1;
   }
+  bitmapd_.cursor(static_cast<size_t>(idx) + 1);
 
-  // clear & mark as used
-  cluster_write(idx, nullptr, 0);
+  if (cluster_zeroed_on_alloc()) {
+    // zeros are stored before the cluster is marked as used
+    cluster_put(idx, std::vector<uint8_t>(static_cast<size_t>(cluster_size_),
+                                          0));
+  } else {
+    // content is zeroed logically until the first write
+    unwritten_.insert(idx);
+  }
+  bitmap_mark(bitmapd_, idx, true);
 
   return idx;
 }
 
+std::vector<int32_t> Filesystem::cluster_alloc(size_t count, int32_t goal) {
+  auto sb = superblock(); // ensure bitmaps are loaded
+  if (count == 0) {
+    return {};
+  }
+  if (goal < 0 || goal >= sb.cluster_count) {
+    goal = static_cast<int32_t>(bitmapd_.cursor());
+  }
+
+  // runs to take as {start, length}
+  std::vector<std::pair<size_t, size_t>> take;
+
+  auto run = bitmapd_.find_run(count, static_cast<size_t>(goal));
+  if (run >= 0) {
+    take.emplace_back(static_cast<size_t>(run), count);
+  } else {
+    // no run is long enough - fewest runs means longest runs first
+    auto runs = bitmapd_.zero_runs();
+    // how far after goal is the run start, wrapping around
+    auto distance = [goal, &sb](size_t start) {
+      return (start + static_cast<size_t>(sb.cluster_count) -
+              static_cast<size_t>(goal)) %
+             static_cast<size_t>(sb.cluster_count);
+    };
+    std::ranges::sort(runs, [&distance](const auto &a, const auto &b) {
+      if (a.second != b.second) {
+        return a.second > b.second;
+      }
+      return distance(a.first) < distance(b.first);
+    });
+
+    size_t remaining = count;
+    for (const auto &[start, length] : runs) {
+      if (remaining == 0) {
+        break;
+      }
+      auto part = std::min(length, remaining);
+      take.emplace_back(start, part);
+      remaining -= part;
+    }
+    if (remaining > 0) {
+      return {}; // not enough free clusters
+    }
+
+    // walk from goal forward, so the file is laid out in one direction
+    std::ranges::sort(take, [&distance](const auto &a, const auto &b) {
+      return distance(a.first) < distance(b.first);
+    });
+  }
+
+  // next allocation continues after this one
+  bitmapd_.cursor(take.back().first + take.back().second);
+
+  std::vector<int32_t> clusters;
+  clusters.reserve(count);
+  auto zeroed = cluster_zeroed_on_alloc();
+  for (const auto &[start, length] : take) {
+    for (size_t i = 0; i < length; i++) {
+      auto idx = static_cast<int32_t>(start + i);
+      if (zeroed) {
+        // zeros are stored before the run is marked as used
+        cluster_put(idx, std::vector<uint8_t>(
+                             static_cast<size_t>(sb.cluster_size), 0));
+      } else {
+        unwritten_.insert(idx);
+      }
+      clusters.push_back(idx);
+    }
+    bitmap_mark(bitmapd_, static_cast<int32_t>(start), length, true);
+  }
+
+  return clusters;
+}
+
 bool Filesystem::cluster_is_empty(int32_t idx) {
   if (idx < 0) {
     throw jkfilesystem_error(
@@ -54,13 +159,7 @@ bool Filesystem::cluster_is_empty(int32_t idx) {
                              ", but you tried " + std::to_string(idx));
   }
 
-  int byte_idx = idx / 8;
-  int bit_idx = idx % 8;
-
-  auto byte = read<uint8_t>(sb.bitmapd_start_addr + byte_idx);
-
-  auto used = bit_get(byte, static_cast<unsigned int>(bit_idx));
-  return !used;
+  return !bitmapd_.get(static_cast<size_t>(idx));
 }
 
 void Filesystem::cluster_write(int32_t idx, const char *data, int32_t size) {
@@ -77,23 +176,17 @@ void Filesystem::cluster_write(int32_t idx, const char *data, int32_t size) {
   }
 
   // bitmap
-  int byte_idx = idx / 8;
-  int bit_idx = idx % 8;
-
-  uint8_t byte = read<uint8_t>(sb.bitmapd_start_addr + byte_idx);
-  bit_set(byte, static_cast<unsigned int>(bit_idx)); // mark as used
-  write(byte, sb.bitmapd_start_addr + byte_idx);
+  bitmap_mark(bitmapd_, idx, true); // mark as used
 
   // cluster
   // zero-initialized
-  std::vector<char> buf(static_cast<size_t>(sb.cluster_size), 0);
+  std::vector<uint8_t> buf(static_cast<size_t>(sb.cluster_size), 0);
   if (!(data == nullptr || size <= 0)) {
     // copy actual data
     std::copy_n(data, size, buf.begin());
   }
-  // write into FS
-  write_bytes(buf.data(), static_cast<size_t>(sb.cluster_size),
-              sb.data_start_addr + sb.cluster_size * idx);
+
+  cluster_put(idx, std::move(buf));
 }
 
 void Filesystem::cluster_free(int32_t idx) {
@@ -109,12 +202,110 @@ void Filesystem::cluster_free(int32_t idx) {
                              ", but you tried " + std::to_string(idx));
   }
 
-  int byte_idx = idx / 8;
-  int bit_idx = idx % 8;
+  if (refcounts_.release(static_cast<size_t>(idx))) {
+    // other files still use it
+    if (durability_ == Durability::ALWAYS) {
+      bitmaps_store();
+    }
+    return;
+  }
+
+  bitmap_mark(bitmapd_, idx, false); // mark as unused
+  unwritten_.erase(idx);
+
+  // content of free cluster doesn't matter, don't write it back
+  cache_.erase(idx);
+}
+
+// PRIVATE
+
+bool Filesystem::cluster_cached() const {
+  return cache_.enabled() && device_->data() == nullptr;
+}
+
+bool Filesystem::cluster_zeroed_on_alloc() const {
+  return secure_zero_ || durability_ == Durability::ALWAYS;
+}
+
+bool Filesystem::cluster_on_device(int32_t idx) const {
+  return !unwritten_.contains(idx) &&
+         !(cluster_cached() && cache_.contains(idx));
+}
+
+void Filesystem::cluster_store(int32_t idx, const std::vector<uint8_t> &data) {
+  auto sb = superblock();
+  write_bytes(reinterpret_cast<const char *>(data.data()), data.size(),
+              sb.data_start_addr + sb.cluster_size * idx);
+}
+
+void Filesystem::cluster_patch(int32_t idx, size_t offset, const char *data,
+                              size_t size) {
+  auto sb = superblock();
+  if (offset + size > static_cast<size_t>(sb.cluster_size)) {
+    throw jkfilesystem_error("Cannot patch cluster " + std::to_string(idx) +
+                             " past its end.");
+  }
+
+  if (unwritten_.contains(idx)) {
+    // the rest is zeros, not whatever is on device
+    std::vector<uint8_t> buf(static_cast<size_t>(sb.cluster_size), 0);
+    std::copy_n(data, size, buf.begin() + static_cast<ptrdiff_t>(offset));
+    cluster_put(idx, std::move(buf));
+    return;
+  }
+
+  auto *cached = cluster_cached() ? cache_.find(idx) : nullptr;
+  if (cached != nullptr) {
+    std::copy_n(data, size, cached->begin() + static_cast<ptrdiff_t>(offset));
+    if (durability_ != Durability::ALWAYS) {
+      cache_.mark_dirty(idx);
+      return;
+    }
+    // write-through, cached copy stays clean
+  }
+
+  write_bytes(data, size,
+              static_cast<size_t>(sb.data_start_addr) +
+                  static_cast<size_t>(sb.cluster_size) * idx + offset);
+}
+
+void Filesystem::cluster_put(int32_t idx, std::vector<uint8_t> data) {
+  unwritten_.erase(idx);
+
+  if (!cluster_cached()) {
+    cluster_store(idx, data);
+  } else if (durability_ == Durability::ALWAYS) {
+    // write-through, cache only serves reads
+    cluster_store(idx, data);
+    cache_.put(idx, std::move(data), false);
+  } else {
+    // written to FS on eviction or flush
+    cache_.put(idx, std::move(data), true);
+  }
+}
+
+void Filesystem::cluster_put_run(int32_t first, size_t count,
+                                 std::span<const uint8_t> data) {
+  auto sb = superblock();
+  if (first < 0 || static_cast<size_t>(first) + count >
+                       static_cast<size_t>(sb.cluster_count)) {
+    throw jkfilesystem_error("Clusters are indexed from 0 to " +
+                             std::to_string(sb.cluster_count - 1) +
+                             ", but you tried run from " +
+                             std::to_string(first));
+  }
+  if (cluster_cached()) {
+    throw jkfilesystem_error("Cannot write clusters past the cache.");
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    unwritten_.erase(first + static_cast<int32_t>(i));
+  }
 
-  auto byte = read<uint8_t>(sb.bitmapd_start_addr + byte_idx);
-  bit_clear(byte, static_cast<unsigned int>(bit_idx)); // mark as unused
-  write(byte, sb.bitmapd_start_addr + byte_idx);
+  write_bytes(reinterpret_cast<const char *>(data.data()),
+              count * static_cast<size_t>(sb.cluster_size),
+              static_cast<size_t>(sb.data_start_addr) +
+                  static_cast<size_t>(sb.cluster_size) * first);
 }
 
 } // namespace jkfs
@@ -2,13 +2,35 @@
 #include "filesystem.hpp"
 #include "structures.hpp"
 #include <algorithm>
+#include <bit>
 #include <cstdint>
+#include <iterator>
+#include <limits>
+#include <set>
+#include <span>
 #include <string>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 namespace jkfs {
 
+namespace {
+
+// bucket of item in directory index, FNV-1a of the name as it is stored
+// (shortened), so a longer name lands where its stored form would be
+size_t name_bucket(const std::string &name, int32_t buckets) {
+  struct dir_item stored{0, name};
+  uint32_t hash = 2166136261u;
+  for (const char *c = stored.item_name.data(); *c != '\0'; c++) {
+    hash ^= static_cast<uint8_t>(*c);
+    hash *= 16777619u;
+  }
+  return hash & static_cast<uint32_t>(buckets - 1);
+}
+
+} // namespace
+
 int32_t Filesystem::dir_create(int32_t parent_id, const std::string &name) {
   int32_t id = -1;
 
@@ -90,77 +112,503 @@ void Filesystem::dir_item_add(int32_t id, int32_t item_id,
 
   struct dir_item item{item_id, item_name};
 
+  auto head = dir_head(id);
+  if (auto index = std::bit_cast<dir_index>(head); index.valid()) {
+    dir_index__add(id, index, item);
+    dentries_.put(id, item.item_name.data(), item_id);
+    return;
+  }
+  if (auto tree = std::bit_cast<dir_tree>(head); tree.valid()) {
+    dir_tree__add(id, tree, item);
+    dentries_.put(id, item.item_name.data(), item_id);
+    return;
+  }
+
+  if (auto &holes = dir_holes(id); !holes.empty()) {
+    dir_item_write(id, *holes.begin(), item);
+    holes.erase(holes.begin());
+    dentries_.put(id, item.item_name.data(), item_id);
+    return;
+  }
+
   auto offset = inode_read(id).file_size;
+  if (uses_dir_index() &&
+      offset + static_cast<int32_t>(sizeof(item)) > cluster_size_) {
+    // directory outgrows its first cluster, from now on items are found by
+    // hash of their name, or in B+tree ordered by name
+    auto items = dir_list(id);
+    items.push_back(item);
+    if (uses_dir_tree()) {
+      dir_tree__build(id, std::move(items));
+    } else {
+      dir_index__build(id, items, 1);
+    }
+    dentries_.put(id, item.item_name.data(), item_id);
+    return;
+  }
+
   file_write(id, offset, reinterpret_cast<const char *>(&item), sizeof(item));
+  // stored name may be shorter, only that one can be found
+  dentries_.put(id, item.item_name.data(), item_id);
 }
 
 void Filesystem::dir_item_remove(int32_t id, const std::string &item_name) {
-  auto items = dir_list(id);
-
-  // find the item to remove
-  auto it = std::ranges::find_if(items, [&item_name](const dir_item &item) {
-    return item.name_matches(item_name);
-  });
-  if (it == items.end()) {
-    return; // the work is already done
+  auto offset = dir_item_offset(id, item_name);
+  if (offset >= 0) {
+    dir_item_erase(id, offset);
   }
-
-  // remove the found item
-  items.erase(it);
-
-  // write back to file - this handles all inode.filesize changes, removing
-  // clusters, ...
-  auto data_size = items.size() * sizeof(dir_item);
-  file_write(id, 0, reinterpret_cast<const char *>(items.data()), data_size);
+  dentries_.put(id, item_name, DentryCache::ABSENT);
 }
 
 int32_t Filesystem::dir_lookup(int32_t id, const std::string &lookup_name) {
-  auto items = dir_list(id);
-
-  // find the matching name
-  auto it = std::ranges::find_if(items, [&lookup_name](const dir_item &item) {
-    return item.name_matches(lookup_name);
-  });
+  if (auto cached = dentries_.find(id, lookup_name)) {
+    return *cached;
+  }
 
-  if (it == items.end()) {
-    return -1;
+  int32_t found = -1;
+  auto head = dir_head(id);
+  if (auto index = std::bit_cast<dir_index>(head); index.valid()) {
+    found = std::get<1>(dir_index__find(id, index, lookup_name));
+  } else if (auto tree = std::bit_cast<dir_tree>(head); tree.valid()) {
+    found = std::get<1>(dir_tree__find(id, tree, lookup_name));
+  } else {
+    auto items = dir_list(id);
+
+    // find the matching name
+    auto it = std::ranges::find_if(items, [&lookup_name](const dir_item &item) {
+      return item.name_matches(lookup_name);
+    });
+    if (it != items.end()) {
+      found = it->inode;
+    }
   }
-  return it->inode;
+
+  dentries_.put(id, lookup_name, found);
+  return found;
 }
 
 std::vector<dir_item> Filesystem::dir_list(int32_t id) {
-  auto raw_file = file_read(id);
+  auto file_size = inode_read(id).file_size;
 
   // prepare space for items
   std::vector<dir_item> items;
+  auto head = dir_head(id);
   { // only reserve if its safe
-    auto size = raw_file.size() / sizeof(dir_item);
+    auto size = file_size / static_cast<int32_t>(sizeof(dir_item));
+    if (auto index = std::bit_cast<dir_index>(head); index.valid()) {
+      size = index.items; // most of indexed directory are free slots
+    }
     if (size > 0) {
-      items.reserve(size);
+      items.reserve(static_cast<size_t>(size));
     }
   }
 
-  // copy all valid items from raw_file to items
-  const dir_item *data = reinterpret_cast<const dir_item *>(raw_file.data());
-  for (size_t i = 0; i < raw_file.size() / sizeof(dir_item); ++i) {
-    if (!data[i].empty()) {
-      items.push_back(data[i]);
+  if (auto tree = std::bit_cast<dir_tree>(head); tree.valid()) {
+    // inner nodes aren't items, only leaves are walked
+    dir_tree__scan(id, tree, "", [&items](const dir_item &item) {
+      items.push_back(item);
+      return true;
+    });
+    return items;
+  }
+
+  // copy all valid items straight from the clusters
+  // items never cross cluster boundary, so neither a chunk boundary
+  file_read_chunks(id, 0, static_cast<size_t>(std::max(file_size, 0)),
+                   [&items](std::span<const uint8_t> chunk) {
+                     const dir_item *data =
+                         reinterpret_cast<const dir_item *>(chunk.data());
+                     for (size_t i = 0; i < chunk.size() / sizeof(dir_item);
+                          ++i) {
+                       if (!data[i].empty()) {
+                         items.push_back(data[i]);
+                       }
+                     }
+                   });
+
+  return items;
+}
+
+void Filesystem::dir_scan(int32_t id, const std::string &prefix,
+                          const Item_Visitor &visitor) {
+  if (auto tree = std::bit_cast<dir_tree>(dir_head(id)); tree.valid()) {
+    dir_tree__scan(id, tree, prefix, visitor);
+    return;
+  }
+
+  auto items = dir_list(id);
+  std::erase_if(items, [&prefix](const dir_item &item) {
+    return !item.name().starts_with(prefix);
+  });
+  std::sort(items.begin(), items.end());
+  for (const auto &item : items) {
+    if (!visitor(item)) {
+      return;
     }
   }
+}
 
+std::vector<dir_item> Filesystem::dir_page(int32_t id,
+                                           const std::string &prefix,
+                                           const Item_Filter &filter,
+                                           size_t offset, size_t limit) {
+  size_t seen = 0;
+  std::vector<dir_item> items;
+  dir_scan(id, prefix, [&filter, &seen, &items, offset,
+                        limit](const dir_item &item) {
+    if (!filter(item)) {
+      return true;
+    }
+    if (seen++ < offset) {
+      return true;
+    }
+    if (items.size() >= limit) {
+      return false;
+    }
+    items.push_back(item);
+    return true;
+  });
   return items;
 }
 
+std::vector<std::pair<dir_item, struct inode>>
+Filesystem::dir_list_plus(int32_t id, const std::string &prefix,
+                          const Item_Filter &filter, size_t offset,
+                          size_t limit) {
+  auto items = dir_page(id, prefix, filter, offset, limit);
+
+  std::vector<int32_t> ids;
+  ids.reserve(items.size());
+  for (const auto &item : items) {
+    ids.push_back(item.inode);
+  }
+  auto inodes = inode_read_many(ids);
+
+  std::vector<std::pair<dir_item, struct inode>> result;
+  result.reserve(items.size());
+  for (size_t i = 0; i < items.size(); i++) {
+    result.emplace_back(items[i], inodes[i]);
+  }
+  return result;
+}
+
 bool Filesystem::dir_is(int32_t inode_id) {
   return inode_read(inode_id).is_dir;
 }
 
 bool Filesystem::dir_empty(int32_t dir_inode_id) {
-  auto inode = inode_read(dir_inode_id);
   // every directory have "." and ".."
   // root directory also have "/"
-  return (inode.file_size <=
-          sizeof(struct dir_item) * (dir_inode_id == root_id() ? 3 : 2));
+  auto own = dir_inode_id == root_id() ? 3 : 2;
+
+  auto head = dir_head(dir_inode_id);
+  if (auto index = std::bit_cast<dir_index>(head); index.valid()) {
+    return index.items <= own;
+  }
+  if (auto tree = std::bit_cast<dir_tree>(head); tree.valid()) {
+    return tree.items <= own;
+  }
+
+  auto inode = inode_read(dir_inode_id);
+  auto items = inode.file_size / static_cast<int32_t>(sizeof(struct dir_item));
+  return items - static_cast<int32_t>(dir_holes(dir_inode_id).size()) <= own;
+}
+
+void Filesystem::rename(int32_t src_parent, const std::string &src_name,
+                        int32_t dst_parent, const std::string &dst_name) {
+  auto src_offset = dir_item_offset(src_parent, src_name);
+  if (src_offset < 0) {
+    throw jkfilesystem_error("Cannot find " + src_name + " to move.");
+  }
+  struct dir_item item;
+  file_read(src_parent, static_cast<size_t>(src_offset),
+            {reinterpret_cast<uint8_t *>(&item), sizeof(item)});
+  auto id = item.inode;
+  if (id == root_id()) {
+    throw jkfilesystem_error("Cannot move root.");
+  }
+  if (dir_lookup(dst_parent, dst_name) >= 0) {
+    throw jkfilesystem_error("File with that name already exists.");
+  }
+
+  // renaming inside one directory only changes the name, unless the name
+  // decides where in the directory the item is
+  if (src_parent == dst_parent && dir_linear(src_parent)) {
+    struct dir_item renamed{id, dst_name};
+    dir_item_write(src_parent, src_offset, renamed);
+    dentries_.put(src_parent, src_name, DentryCache::ABSENT);
+    dentries_.put(src_parent, renamed.item_name.data(), id);
+    return;
+  }
+
+  bool moved_dir = src_parent != dst_parent && dir_is(id);
+  if (moved_dir) {
+    // directory cannot become its own descendant
+    for (auto up = dst_parent; up != root_id(); up = dir_lookup(up, "..")) {
+      if (up == id) {
+        throw jkfilesystem_error("Cannot move directory inside itself.");
+      }
+    }
+  }
+
+  dir_item_add(dst_parent, id, dst_name);
+  int32_t dotdot = -1;
+  try {
+    if (moved_dir) {
+      dotdot = dir_item_offset(id, "..");
+      dir_item_write(id, dotdot, dir_item{dst_parent, ".."});
+    }
+    if (src_parent == dst_parent) {
+      // adding may have rebuilt the index or moved items between nodes
+      src_offset = dir_item_offset(src_parent, src_name);
+    }
+    dir_item_erase(src_parent, src_offset);
+  } catch (...) {
+    if (dotdot >= 0) {
+      dir_item_write(id, dotdot, dir_item{src_parent, ".."});
+    }
+    dentries_.erase(id, "..");
+    dir_item_remove(dst_parent, dst_name);
+    throw;
+  }
+  dentries_.put(src_parent, src_name, DentryCache::ABSENT);
+  if (moved_dir) {
+    dentries_.put(id, "..", dst_parent);
+  }
+
+  // inode-path of cwd goes through the moved directory
+  if (moved_dir && std::ranges::find(cwd_, id) != cwd_.end()) {
+    std::vector<int32_t> path;
+    for (auto up = cwd_.back(); up != root_id(); up = dir_lookup(up, "..")) {
+      path.push_back(up);
+    }
+    path.push_back(root_id());
+    std::ranges::reverse(path);
+    cwd_ = path;
+  }
+}
+
+// PRIVATE
+
+int32_t Filesystem::dir_item_offset(int32_t id, const std::string &name) {
+  auto head = dir_head(id);
+  if (auto index = std::bit_cast<dir_index>(head); index.valid()) {
+    return std::get<0>(dir_index__find(id, index, name));
+  }
+  if (auto tree = std::bit_cast<dir_tree>(head); tree.valid()) {
+    return std::get<0>(dir_tree__find(id, tree, name));
+  }
+
+  int32_t found = -1;
+  int32_t offset = 0;
+
+  auto size = static_cast<size_t>(std::max(inode_read(id).file_size, 0));
+
+  file_read_chunks(id, 0, size,
+                   [&found, &offset, &name](std::span<const uint8_t> chunk) {
+                     const dir_item *data =
+                         reinterpret_cast<const dir_item *>(chunk.data());
+                     for (size_t i = 0; i < chunk.size() / sizeof(dir_item);
+                          ++i) {
+                       if (found < 0 && !data[i].empty() &&
+                           data[i].name_matches(name)) {
+                         found = offset;
+                       }
+                       offset += static_cast<int32_t>(sizeof(dir_item));
+                     }
+                   });
+
+  return found;
+}
+
+void Filesystem::dir_item_write(int32_t id, int32_t offset,
+                                const dir_item &item) {
+  auto clusters =
+      file_map_range(id, static_cast<size_t>(offset / cluster_size_), 1);
+  if (clusters.empty()) {
+    throw jkfilesystem_error("Directory item is out of the directory.");
+  }
+
+  // items never cross cluster boundary
+  cluster_patch(clusters[0], static_cast<size_t>(offset % cluster_size_),
+                reinterpret_cast<const char *>(&item), sizeof(item));
+}
+
+void Filesystem::dir_item_erase(int32_t id, int32_t offset) {
+  auto head = dir_head(id);
+  if (auto index = std::bit_cast<dir_index>(head); index.valid()) {
+    // other items must stay in their buckets
+    dir_item_write(id, offset, dir_item{});
+    index.items--;
+    dir_index__write(id, index);
+    return;
+  }
+  if (auto tree = std::bit_cast<dir_tree>(head); tree.valid()) {
+    dir_tree__erase(id, tree, offset);
+    return;
+  }
+
+  auto &holes = dir_holes(id);
+  auto inode = inode_read(id);
+  auto item_size = static_cast<int32_t>(sizeof(dir_item));
+
+  if (offset != inode.file_size - item_size) {
+    dir_item_write(id, offset, dir_item{});
+    holes.insert(offset);
+
+    auto items = static_cast<size_t>(inode.file_size / item_size);
+    if (holes.size() >= DIR_COMPACT_MIN && holes.size() * 2 >= items) {
+      dir_compact(id);
+    }
+    return;
+  }
+
+  // the last item & holes before it are cut off, clusters are kept, the
+  // same as when the directory is rewritten
+  inode.file_size = offset;
+  while (!holes.empty() && *holes.rbegin() == inode.file_size - item_size) {
+    inode.file_size -= item_size;
+    holes.erase(std::prev(holes.end()));
+  }
+  inode_write(id, inode);
+}
+
+std::set<int32_t> &Filesystem::dir_holes(int32_t id) {
+  if (auto *holes = dir_holes_.find(id)) {
+    return *holes;
+  }
+
+  std::set<int32_t> holes;
+  int32_t offset = 0;
+  auto size = static_cast<size_t>(std::max(inode_read(id).file_size, 0));
+  file_read_chunks(id, 0, size,
+                   [&holes, &offset](std::span<const uint8_t> chunk) {
+                     const dir_item *data =
+                         reinterpret_cast<const dir_item *>(chunk.data());
+                     for (size_t i = 0; i < chunk.size() / sizeof(dir_item);
+                          ++i) {
+                       if (data[i].empty()) {
+                         holes.insert(offset);
+                       }
+                       offset += static_cast<int32_t>(sizeof(dir_item));
+                     }
+                   });
+
+  return dir_holes_.put(id, std::move(holes));
+}
+
+void Filesystem::dir_compact(int32_t id) {
+  auto items = dir_list(id);
+
+  // write back to file - this handles all inode.filesize changes
+  auto data_size = items.size() * sizeof(dir_item);
+  file_write(id, 0, reinterpret_cast<const char *>(items.data()), data_size);
+  dir_holes_.put(id, {});
+}
+
+struct dir_item Filesystem::dir_head(int32_t id) {
+  struct dir_item head{};
+
+  if (uses_dir_index()) {
+    file_read(id, 0, {reinterpret_cast<uint8_t *>(&head), sizeof(head)});
+  }
+  return head;
+}
+
+bool Filesystem::dir_linear(int32_t id) {
+  auto head = dir_head(id);
+  return !std::bit_cast<dir_index>(head).valid() &&
+         !std::bit_cast<dir_tree>(head).valid();
+}
+
+void Filesystem::dir_index__write(int32_t id, const struct dir_index &index) {
+  dir_item_write(id, 0, std::bit_cast<dir_item>(index));
+}
+
+std::tuple<int32_t, int32_t>
+Filesystem::dir_index__find(int32_t id, const struct dir_index &index,
+                            const std::string &name) {
+  auto bucket = name_bucket(name, index.buckets);
+  auto clusters = file_map_range(id, bucket + 1, 1);
+  if (clusters.empty()) {
+    throw jkfilesystem_error("Directory index is corrupted.");
+  }
+
+  auto view = cluster_view(clusters[0]);
+  const auto *data = reinterpret_cast<const dir_item *>(view.data());
+  for (size_t i = 0; i < view.size() / sizeof(dir_item); i++) {
+    if (!data[i].empty() && data[i].name_matches(name)) {
+      auto offset = (bucket + 1) * static_cast<size_t>(cluster_size_) +
+                    i * sizeof(dir_item);
+      return {static_cast<int32_t>(offset), data[i].inode};
+    }
+  }
+  return {-1, -1};
+}
+
+void Filesystem::dir_index__add(int32_t id, struct dir_index index,
+                                const dir_item &item) {
+  auto bucket = name_bucket(item.item_name.data(), index.buckets);
+  auto clusters = file_map_range(id, bucket + 1, 1);
+  if (clusters.empty()) {
+    throw jkfilesystem_error("Directory index is corrupted.");
+  }
+
+  auto view = cluster_view(clusters[0]);
+  const auto *data = reinterpret_cast<const dir_item *>(view.data());
+  for (size_t i = 0; i < view.size() / sizeof(dir_item); i++) {
+    if (data[i].empty()) {
+      auto offset = (bucket + 1) * static_cast<size_t>(cluster_size_) +
+                    i * sizeof(dir_item);
+      dir_item_write(id, static_cast<int32_t>(offset), item);
+      index.items++;
+      dir_index__write(id, index);
+      return;
+    }
+  }
+
+  // bucket is full
+  auto items = dir_list(id);
+  items.push_back(item);
+  dir_index__build(id, items, index.buckets * 2);
+}
+
+void Filesystem::dir_index__build(int32_t id,
+                                  const std::vector<dir_item> &items,
+                                  int32_t buckets) {
+  auto slots = static_cast<size_t>(cluster_size_) / sizeof(dir_item);
+
+  // header & its unused cluster, then buckets
+  std::vector<dir_item> data;
+  for (bool overflow = true; overflow;) {
+    if (static_cast<int64_t>(buckets + 1) * cluster_size_ >
+        std::numeric_limits<int32_t>::max()) {
+      throw jkfilesystem_error("Directory cannot hold any more items.");
+    }
+
+    data.assign((static_cast<size_t>(buckets) + 1) * slots, dir_item{});
+    std::vector<size_t> used(static_cast<size_t>(buckets), 0);
+    overflow = false;
+    for (const auto &item : items) {
+      auto bucket = name_bucket(item.item_name.data(), buckets);
+      if (used[bucket] == slots) {
+        overflow = true;
+        buckets *= 2;
+        break;
+      }
+      data[(bucket + 1) * slots + used[bucket]++] = item;
+    }
+  }
+
+  struct dir_index index{};
+  index.buckets = buckets;
+  index.items = static_cast<int32_t>(items.size());
+  data[0] = std::bit_cast<dir_item>(index);
+
+  // only enlarges, so it fails before anything is written
+  file_write(id, 0, reinterpret_cast<const char *>(data.data()),
+             data.size() * sizeof(dir_item));
+  dir_holes_.erase(id);
 }
 
 } // namespace jkfs
@@ -2,14 +2,21 @@
 #include "filesystem.hpp"
 #include "structures.hpp"
 #include <algorithm>
+#include <cerrno>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <iterator>
+#include <limits>
 #include <ranges>
+#include <span>
+#include <string>
 #include <tuple>
 #include <utility>
 #include <vector>
 
+#include <unistd.h>
+
 namespace jkfs {
 
 int32_t Filesystem::file_create(int32_t parent_id, std::string file_name) {
@@ -31,7 +38,11 @@ int32_t Filesystem::file_create(int32_t parent_id, std::string file_name) {
     file.node_id = inode;
     file.is_dir = false;
     file.file_size = 0;
-    file.direct[0] = cluster;
+    if (uses_extents()) {
+      file.extent(0, {cluster, 1});
+    } else {
+      file.direct[0] = cluster;
+    }
 
     // write inode
     inode_write(inode, file);
@@ -72,6 +83,11 @@ int32_t Filesystem::file_create_sized(int32_t parent_inode_id,
 }
 
 void Filesystem::file_ensure_size(int32_t inode_id, int32_t new_size) {
+  if (uses_extents()) {
+    file_ensure_size__extents(inode_id, new_size);
+    return;
+  }
+
   // count how many clusters are needed
   auto need = file_ensure_size__count_clusters(new_size);
   if (!need.possible) {
@@ -83,16 +99,30 @@ void Filesystem::file_ensure_size(int32_t inode_id, int32_t new_size) {
   auto have_data = std::get<0>(have);
   auto have_overhead = std::get<1>(have);
 
+  // an empty file holds its first cluster only as a placeholder - if it stands
+  // in the way of contiguous data, allocate all data elsewhere and drop it
+  std::vector<int32_t> keep_data = have_data;
+  std::vector<int32_t> placeholder;
+  if (need.data > 1 && have_data.size() == 1 && have_overhead.empty() &&
+      inode_read(inode_id).file_size == 0 &&
+      file_ensure_size__drop_placeholder(have_data[0], need.data)) {
+    placeholder = have_data;
+    keep_data.clear();
+  }
+
   // is used in backup
   struct inode inode;
   std::vector<int32_t> new_data;
   std::vector<int32_t> new_overhead;
+  std::vector<Slot_Patch> patches;
   int backup_stage = 0;
 
   try {
     // allocate
-    std::tie(new_data, new_overhead) =
-        file_ensure_size__fill(need, have_data.size(), have_overhead.size());
+    // continue right after the end of file
+    int32_t goal = keep_data.empty() ? -1 : keep_data.back() + 1;
+    std::tie(new_data, new_overhead) = file_ensure_size__fill(
+        need, keep_data.size(), have_overhead.size(), goal);
     backup_stage = 1;
 
     // write all
@@ -102,26 +132,33 @@ void Filesystem::file_ensure_size(int32_t inode_id, int32_t new_size) {
 
     // = prepare what to write
     std::vector<int32_t> join_data =
-        file_ensure_size__join(have_data, new_data);
+        file_ensure_size__join(keep_data, new_data);
     std::vector<int32_t> join_overhead =
         file_ensure_size__join(have_overhead, new_overhead);
 
-    // = write only overhead clusters
-    file_ensure_size__write_overhead_clusters(inode, join_overhead);
+    // = write only slots which change, inode is kept in memory
+    patches = file_ensure_size__append(inode, join_data, keep_data.size(),
+                                       join_overhead, have_overhead.size());
     backup_stage = 2;
-    // = write only data clusters
-    file_ensure_size__write_clusters_data(inode, join_data, join_overhead);
-    backup_stage = 3;
     // = write inode back to fs
     inode.file_size = new_size;
     inode_write(inode.node_id, inode);
+    file_block_map(inode_id, {join_data, join_overhead});
+
+    for (const auto &cluster : placeholder) {
+      cluster_free(cluster);
+    }
   } catch (...) {
+    block_maps_.erase(inode_id);
+
     // go from back & reverse all the actions to be in the before state
     switch (backup_stage) {
-    case 3:
-      file_ensure_size__write_clusters_data(inode, have_data, have_overhead);
     case 2:
-      file_ensure_size__write_overhead_clusters(inode, have_overhead);
+      // all written slots were empty before
+      for (const auto &patch : patches) {
+        file_write__slots(patch.cluster, patch.first,
+                          std::vector<int32_t>(patch.values.size(), 0));
+      }
     case 1:
       for (const auto &cluster : new_data) {
         cluster_free(cluster);
@@ -142,66 +179,319 @@ void Filesystem::file_write(int32_t inode_id, int32_t offset, const char *data,
                             size_t data_size) {
   // if dont have enough space, resize
   file_ensure_size(inode_id, static_cast<int32_t>(data_size) + offset);
+  file_write__range(inode_id, offset, data, data_size);
+}
+
+void Filesystem::file_copy_range(int32_t src_id, size_t src_offset,
+                                 int32_t dst_id, size_t dst_offset,
+                                 size_t length) {
+  auto src_size =
+      static_cast<size_t>(std::max(inode_read(src_id).file_size, 0));
+  if (src_offset >= src_size) {
+    return;
+  }
+  length = std::min(length, src_size - src_offset);
+  if (dst_offset + length >
+      static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+    throw jkfilesystem_error("File would be too big.");
+  }
 
-  // list all clusters to write into
-  auto clusters_tuple = file_list_clusters(inode_id);
-  // only take data clusters
-  auto clusters = std::get<0>(clusters_tuple);
+  // only enlarge, bytes after the range stay
+  auto dst_size = inode_read(dst_id).file_size;
+  auto dst_end = static_cast<int32_t>(dst_offset + length);
+  if (dst_end > dst_size) {
+    file_ensure_size(dst_id, dst_end);
+  }
+
+  // overlapping range of the same file to the right is copied from the end
+  bool backwards = src_id == dst_id && dst_offset > src_offset &&
+                   dst_offset < src_offset + length;
+
+  std::vector<uint8_t> buffer(std::min(stream_chunk_, length));
+  size_t done = 0;
+  while (done < length) {
+    auto count = std::min(buffer.size(), length - done);
+    auto from = backwards ? length - done - count : done;
+
+    count = file_read(src_id, src_offset + from, {buffer.data(), count});
+    file_write__range(dst_id, static_cast<int32_t>(dst_offset + from),
+                      reinterpret_cast<const char *>(buffer.data()), count);
+    done += count;
+  }
+}
+
+void Filesystem::file_write__range(int32_t inode_id, int32_t offset,
+                                   const char *data, size_t data_size) {
+  if (data_size == 0) {
+    return;
+  }
+  // clusters shared with other files get copied first
+  file_unshare(inode_id, static_cast<size_t>(offset), data_size);
 
+  // list only clusters to write into
   size_t start_cluster_idx = static_cast<size_t>(offset / cluster_size_);
   size_t start_cluster_offset = static_cast<size_t>(offset % cluster_size_);
+  size_t end_cluster_idx =
+      (static_cast<size_t>(offset) + data_size - 1) / cluster_size_;
+  auto clusters = file_map_range(inode_id, start_cluster_idx,
+                                 end_cluster_idx - start_cluster_idx + 1);
+  if (clusters.size() != end_cluster_idx - start_cluster_idx + 1) {
+    throw jkfilesystem_error(
+        "Something is wrong, cluster_idx >= clusters.size()");
+  }
 
   // look at the data differently
   std::span<uint8_t> data_to_write(
       reinterpret_cast<uint8_t *>(const_cast<char *>(data)), data_size);
 
   size_t written_bytes = 0;
-  size_t cluster_idx = start_cluster_idx;
+  size_t i = 0;
+  auto cs = static_cast<size_t>(cluster_size_);
 
   while (written_bytes < data_size) {
-    // get current cluster index
-    if (cluster_idx >= clusters.size()) {
-      throw jkfilesystem_error(
-          "Something is wrong, cluster_idx >= clusters.size()");
-    }
-    auto cluster = clusters[cluster_idx];
+    auto cluster = clusters[i];
     // if 1st cluster: give offset, otherwise 0
-    auto cluster_offset =
-        start_cluster_idx == cluster_idx ? start_cluster_offset : 0;
-
-    file_write__cluster(cluster, cluster_offset, data_to_write, written_bytes);
+    auto cluster_offset = i == 0 ? start_cluster_offset : 0;
+
+    // whole neighbouring clusters go to device at once
+    size_t whole = (data_size - written_bytes) / cs;
+    size_t n = 1;
+    if (cluster_offset == 0 && !cluster_cached()) {
+      while (n < whole && n < run_max_ &&
+             clusters[i + n] == cluster + static_cast<int32_t>(n)) {
+        n++;
+      }
+    }
+    if (n > 1) {
+      cluster_put_run(cluster, n, data_to_write.subspan(written_bytes, n * cs));
+      written_bytes += n * cs;
+      i += n;
+      continue;
+    }
 
-    cluster_idx++;
+    file_write__cluster(cluster, static_cast<int32_t>(cluster_offset),
+                        data_to_write, written_bytes);
+    i++;
   }
 }
 
 std::vector<uint8_t> Filesystem::file_read(int32_t inode_id) {
   auto file_size = inode_read(inode_id).file_size;
 
-  auto clusters = file_list_clusters(inode_id);
-  auto data_clusters = std::get<0>(clusters);
+  std::vector<uint8_t> output(static_cast<size_t>(std::max(file_size, 0)));
+  output.resize(file_read(inode_id, 0, output));
 
-  std::vector<uint8_t> output;
-  if (file_size > 0) {
-    output.reserve(file_size);
-  }
+  return output;
+}
+
+size_t Filesystem::file_read(int32_t inode_id, size_t offset,
+                             std::span<uint8_t> out) {
+  size_t read = 0;
+  file_read_chunks(inode_id, offset, out.size(),
+                   [&out, &read](std::span<const uint8_t> chunk) {
+                     std::ranges::copy(chunk, out.begin() + read);
+                     read += chunk.size();
+                   });
+  return read;
+}
 
-  size_t remaining = file_size;
+void Filesystem::file_read_chunks(int32_t inode_id, size_t offset,
+                                  size_t length, const Chunk_Reader &reader) {
+  std::vector<uint8_t> buffer;
+
+  file_read__runs(
+      inode_id, offset, length,
+      [this, &reader, &buffer](size_t addr, size_t count) {
+        if (device_->data() != nullptr) {
+          reader({device_->data() + addr, count});
+        } else {
+          buffer.resize(count);
+          device_->read(addr, buffer.data(), count);
+          reader(buffer);
+        }
+      },
+      reader);
+}
 
-  for (const auto &cluster : data_clusters) {
-    if (remaining == 0) {
+void Filesystem::file_copy_out(int32_t inode_id, int fd) {
+  auto size =
+      static_cast<size_t>(std::max(inode_read(inode_id).file_size, 0));
+  size_t pos = 0; // where in fd the next byte goes
+
+  auto put = [fd, &pos](std::span<const uint8_t> chunk) {
+    fd_write(fd, pos, chunk);
+    pos += chunk.size();
+  };
+
+  std::vector<uint8_t> buffer;
+  file_read__runs(
+      inode_id, 0, size,
+      [this, fd, &pos, &put, &buffer](size_t addr, size_t count) {
+        auto done = device_->copy_to_fd(addr, fd, pos, count);
+        pos += done;
+        if (done == count) {
+          return;
+        }
+        // device can't copy the rest itself
+        addr += done;
+        count -= done;
+        if (device_->data() != nullptr) {
+          put({device_->data() + addr, count});
+        } else {
+          buffer.resize(count);
+          device_->read(addr, buffer.data(), count);
+          put(buffer);
+        }
+      },
+      put);
+}
+
+size_t Filesystem::file_copy_in(int32_t inode_id, int fd, size_t size) {
+  auto cs = static_cast<size_t>(cluster_size_);
+  auto clusters = file_map_range(inode_id, 0, (size + cs - 1) / cs);
+  auto sb = superblock();
+
+  // whole clusters without copy in cache go from fd to device directly,
+  // the partial last cluster must keep zeros after the data
+  size_t whole = std::min(size / cs, clusters.size());
+  size_t pos = 0; // copied bytes
+  size_t i = 0;
+  while (i < whole) {
+    auto cluster = clusters[i];
+    if (cluster_cached() && cache_.contains(cluster)) {
       break;
     }
+    size_t n = 1;
+    while (i + n < whole && n < run_max_ &&
+           clusters[i + n] == cluster + static_cast<int32_t>(n) &&
+           !(cluster_cached() && cache_.contains(clusters[i + n]))) {
+      n++;
+    }
+
+    auto addr = static_cast<size_t>(sb.data_start_addr) +
+                static_cast<size_t>(cluster) * cs;
+    auto done = device_->copy_from_fd(fd, pos, addr, n * cs);
+    // partially copied cluster will be written whole again below
+    auto done_clusters = done / cs;
+    for (size_t k = 0; k < done_clusters; k++) {
+      unwritten_.erase(cluster + static_cast<int32_t>(k));
+    }
+    pos += done_clusters * cs;
+    i += done_clusters;
+    if (done_clusters < n) {
+      break;
+    }
+  }
+  if (pos > 0) {
+    write_done();
+  }
+
+  // the rest through memory, clusters are allocated already
+  std::vector<uint8_t> buffer(std::min(stream_chunk_, size - pos));
+  while (pos < size) {
+    auto count = fd_read(fd, pos,
+                         {buffer.data(), std::min(buffer.size(), size - pos)});
+    if (count == 0) {
+      break; // file got shorter
+    }
+    file_write__range(inode_id, static_cast<int32_t>(pos),
+                      reinterpret_cast<const char *>(buffer.data()), count);
+    pos += count;
+  }
 
-    auto data = cluster_read(cluster);
+  // size only once, fd may have been shorter
+  auto inode = inode_read(inode_id);
+  if (inode.file_size != static_cast<int32_t>(pos)) {
+    inode.file_size = static_cast<int32_t>(pos);
+    inode_write(inode_id, inode);
+  }
 
-    size_t take = std::min(remaining, data.size());
-    output.insert(output.end(), data.begin(), data.begin() + take);
+  return pos;
+}
 
-    remaining -= take;
+std::vector<int32_t> Filesystem::file_map_range(int32_t inode_id,
+                                                size_t first, size_t count) {
+  std::vector<int32_t> result;
+
+  // the whole map is known
+  if (auto *map = block_maps_.find(inode_id)) {
+    const auto &data = map->data;
+    if (first < data.size()) {
+      auto last = std::min(data.size(), first + count);
+      result.assign(data.begin() + static_cast<ptrdiff_t>(first),
+                    data.begin() + static_cast<ptrdiff_t>(last));
+    }
+    return result;
   }
 
-  return output;
+  auto inode = inode_read(inode_id);
+
+  if (uses_extents()) {
+    // extents are few, take them all & skip to first
+    auto extents = std::get<0>(file_list_extents__nodes(inode));
+    size_t skip = first;
+    for (const auto &e : extents) {
+      auto length = static_cast<size_t>(e.length);
+      if (skip >= length) {
+        skip -= length;
+        continue;
+      }
+      for (size_t i = skip; i < length && result.size() < count; i++) {
+        result.push_back(e.start + static_cast<int32_t>(i));
+      }
+      skip = 0;
+      if (result.size() >= count) {
+        break;
+      }
+    }
+    return result;
+  }
+
+  // legacy - read only indirect clusters covering the range
+  const size_t direct = std::size(inode.direct);
+  const size_t in_cluster = cluster_size_ / sizeof(int32_t);
+  std::vector<int32_t> indirects; // content of indirect2
+  std::vector<int32_t> slots;     // content of current indirect1
+  int32_t slots_of = 0;           // cluster which is loaded in slots
+
+  for (size_t i = first; i < first + count; i++) {
+    int32_t cluster = 0;
+    if (i < direct) {
+      cluster = inode.direct[i];
+    } else {
+      size_t slot = i - direct;
+      int32_t holder = inode.indirect1;
+      if (slot >= in_cluster) {
+        slot -= in_cluster;
+        if (inode.indirect2 <= 0) {
+          break;
+        }
+        if (indirects.empty()) {
+          indirects = file_list_clusters__indirect(inode.indirect2);
+        }
+        if (slot / in_cluster >= indirects.size()) {
+          break;
+        }
+        holder = indirects[slot / in_cluster];
+        slot %= in_cluster;
+      }
+      if (holder <= 0) {
+        break;
+      }
+      if (slots_of != holder) {
+        slots = file_list_clusters__indirect(holder);
+        slots_of = holder;
+      }
+      cluster = slot < slots.size() ? slots[slot] : 0;
+    }
+
+    if (cluster <= 0) {
+      break; // file ends here
+    }
+    result.push_back(cluster);
+  }
+
+  return result;
 }
 
 void Filesystem::file_delete(int32_t parent_inode_id, std::string file_name) {
@@ -226,17 +516,150 @@ void Filesystem::file_delete(int32_t parent_inode_id, std::string file_name) {
   for (const auto &cluster : data_clusters) {
     cluster_free(cluster);
   }
+  for (const auto &cluster : std::get<1>(clusters)) {
+    cluster_free(cluster);
+  }
+  block_maps_.erase(inode);
 
   // free inode
   inode_free(inode);
 }
 
+int32_t Filesystem::file_clone(int32_t src_id, int32_t parent_id,
+                               const std::string &file_name) {
+  if (!uses_refcounts()) {
+    throw jkfilesystem_error("Clusters of this filesystem cannot be shared.");
+  }
+  auto src = inode_read(src_id);
+  if (src.is_dir) {
+    throw jkfilesystem_error("Cannot share clusters of a directory.");
+  }
+  auto extents = std::get<0>(file_list_extents(src_id));
+  auto data = std::get<0>(file_list_clusters(src_id));
+
+  auto id = file_create(parent_id, file_name);
+  auto inode = inode_read(id);
+  auto placeholder = inode.extent(0).start;
+
+  size_t shared = 0;
+  Extents_Write done;
+  try {
+    for (const auto &cluster : data) {
+      cluster_share(cluster);
+      shared++;
+    }
+
+    // only extents are written, data stay where they are
+    file_extents__write(inode, extents, {}, -1, done);
+    inode.file_size = src.file_size;
+    inode_write(id, inode);
+  } catch (...) {
+    file_extents__undo(done);
+    for (size_t i = 0; i < shared; i++) {
+      cluster_free(data[i]); // drops the reference only
+    }
+    file_delete(parent_id, file_name);
+
+    throw;
+  }
+
+  file_block_map(id, {data, done.nodes});
+  cluster_free(placeholder);
+
+  return id;
+}
+
 // PRIVATE
 
 std::tuple<std::vector<int32_t>, std::vector<int32_t>>
 Filesystem::file_list_clusters(int32_t inode_id) {
+  auto *map = block_maps_.find(inode_id);
+  if (map == nullptr) {
+    map = &block_maps_.put(inode_id, file_list_clusters__walk(inode_id));
+  }
+
+  return {map->data, map->overhead};
+}
+
+std::tuple<std::vector<struct extent>, std::vector<int32_t>>
+Filesystem::file_list_extents(int32_t inode_id) {
+  // merge neighbouring clusters of (cached) block map
+  auto [data, overhead] = file_list_clusters(inode_id);
+  std::vector<struct extent> extents;
+  for (const auto &cluster : data) {
+    if (!extents.empty() &&
+        extents.back().start + extents.back().length == cluster) {
+      extents.back().length++;
+    } else {
+      extents.push_back({cluster, 1});
+    }
+  }
+
+  return {extents, overhead};
+}
+
+std::tuple<std::vector<struct extent>, std::vector<int32_t>>
+Filesystem::file_list_extents__nodes(const struct inode &inode) {
+  std::vector<struct extent> extents;
+  std::vector<int32_t> nodes;
+
+  // in inode
+  for (size_t i = 0; i < inode::EXTENTS; i++) {
+    auto e = inode.extent(i);
+    if (e.length <= 0) {
+      return {extents, nodes}; // already have all
+    }
+    extents.push_back(e);
+  }
+
+  // in chain of nodes
+  auto sb = superblock();
+  for (auto node = inode.indirect2; node > 0;) {
+    if (nodes.size() >= static_cast<size_t>(sb.cluster_count)) {
+      throw jkfilesystem_error("Extent nodes of inode " +
+                               std::to_string(inode.node_id) +
+                               " are chained in a loop.");
+    }
+    nodes.push_back(node);
+
+    auto bytes = cluster_view(node);
+    struct extent_node header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+
+    auto count = std::min(static_cast<size_t>(std::max(header.count, 0)),
+                          file_extents_in_node());
+    std::span<const struct extent> in_node{
+        reinterpret_cast<const struct extent *>(bytes.data() + sizeof(header)),
+        count};
+    extents.insert(extents.end(), in_node.begin(), in_node.end());
+
+    node = header.next;
+  }
+
+  return {extents, nodes};
+}
+
+size_t Filesystem::file_extents_in_node() const {
+  return (static_cast<size_t>(cluster_size_) - sizeof(struct extent_node)) /
+         sizeof(struct extent);
+}
+
+Block_Map Filesystem::file_list_clusters__walk(int32_t inode_id) {
   std::vector<int32_t> data;
   std::vector<int32_t> overhead;
+
+  if (uses_extents()) {
+    std::vector<struct extent> extents;
+    std::tie(extents, overhead) =
+        file_list_extents__nodes(inode_read(inode_id));
+    for (const auto &e : extents) {
+      for (int32_t i = 0; i < e.length; i++) {
+        data.push_back(e.start + i);
+      }
+    }
+    return {data, overhead};
+  }
+
   auto inode = inode_read(inode_id);
 
   // direct
@@ -276,11 +699,15 @@ Filesystem::file_list_clusters(int32_t inode_id) {
   return {data, overhead};
 }
 
+void Filesystem::file_block_map(int32_t inode_id, Block_Map map) {
+  block_maps_.put(inode_id, std::move(map));
+}
+
 std::vector<int32_t>
 Filesystem::file_list_clusters__indirect(int32_t cluster_idx) {
   std::vector<int32_t> clusters;
 
-  auto bytes = cluster_read(cluster_idx);
+  auto bytes = cluster_view(cluster_idx);
   std::span<const int32_t> cluster_idxs{
       reinterpret_cast<const int32_t *>(bytes.data()),
       bytes.size() / sizeof(int32_t)};
@@ -295,12 +722,28 @@ Filesystem::file_list_clusters__indirect(int32_t cluster_idx) {
   return clusters;
 }
 
+void Filesystem::file_write__slots(int32_t cluster_idx, size_t first_slot,
+                                   const std::vector<int32_t> &values) {
+  cluster_patch(cluster_idx, first_slot * sizeof(int32_t),
+                reinterpret_cast<const char *>(values.data()),
+                values.size() * sizeof(int32_t));
+}
+
 void Filesystem::file_write__cluster(int32_t cluster_idx,
                                      int32_t offset_in_cluster,
                                      const std::span<uint8_t> &data_to_write,
                                      size_t &written_bytes) {
-  // always read - because this function should not discard other data
-  std::vector<uint8_t> raw = cluster_read(cluster_idx);
+  std::vector<uint8_t> raw;
+  if (offset_in_cluster == 0 &&
+      data_to_write.size() - written_bytes >=
+          static_cast<size_t>(cluster_size_)) {
+    // whole cluster is overwritten, nothing to keep
+    raw.resize(static_cast<size_t>(cluster_size_));
+  } else {
+    // read - because this function should not discard other data
+    // (never written cluster reads as zeros without touching the device)
+    raw = cluster_read(cluster_idx);
+  }
 
   // start somewhere, end correctly
   for (int i = offset_in_cluster; i < cluster_size_; i++) {
@@ -367,7 +810,8 @@ Filesystem::file_ensure_size__count_clusters(int32_t size) {
 std::tuple<std::vector<int32_t>, std::vector<int32_t>>
 Filesystem::file_ensure_size__fill(const struct Needed_Clusters &need,
                                    const size_t have_data_size,
-                                   const size_t have_overhead_size) {
+                                   const size_t have_overhead_size,
+                                   int32_t goal) {
   auto need_overhead = need.indirect1 + need.indirect2;
 
   std::vector<int32_t> new_data;
@@ -386,21 +830,20 @@ Filesystem::file_ensure_size__fill(const struct Needed_Clusters &need,
 
   try {
     // data
-    for (auto i = have_data_size; i < need.data; i++) {
-      auto cluster = cluster_alloc();
-      if (cluster == -1) {
+    if (need.data > have_data_size) {
+      new_data = cluster_alloc(need.data - have_data_size, goal);
+      if (new_data.empty()) {
         throw jkfilesystem_error("Cannot allocate more clusters for data...");
       }
-      new_data.push_back(cluster);
+      goal = new_data.back() + 1;
     }
 
     // overhead
-    for (auto i = have_overhead_size; i < need_overhead; i++) {
-      auto cluster = cluster_alloc();
-      if (cluster == -1) {
+    if (need_overhead > have_overhead_size) {
+      new_overhead = cluster_alloc(need_overhead - have_overhead_size, goal);
+      if (new_overhead.empty()) {
         throw jkfilesystem_error("Cannot allocate more clusters for overhead.");
       }
-      new_overhead.push_back(cluster);
     }
 
   } catch (...) {
@@ -418,6 +861,233 @@ Filesystem::file_ensure_size__fill(const struct Needed_Clusters &need,
   return {new_data, new_overhead};
 }
 
+void Filesystem::file_ensure_size__extents(int32_t inode_id,
+                                           int32_t new_size) {
+  auto inode = inode_read(inode_id);
+  auto [extents, nodes] = file_list_extents(inode_id);
+
+  size_t have = 0;
+  for (const auto &e : extents) {
+    have += static_cast<size_t>(e.length);
+  }
+  // ceil of how many data clusters needed
+  size_t need = (static_cast<size_t>(std::max(new_size, 0)) + cluster_size_ -
+                 1) /
+                cluster_size_;
+
+  if (need <= have) {
+    // only can and will enlarge, clusters are kept
+    inode.file_size = new_size;
+    inode_write(inode_id, inode);
+    return;
+  }
+
+  std::vector<int32_t> placeholder;
+  if (have == 1 && inode.file_size == 0 &&
+      file_ensure_size__drop_placeholder(extents[0].start, need)) {
+    placeholder.push_back(extents[0].start);
+    extents.clear();
+    have = 0;
+  }
+
+  std::vector<int32_t> new_data;
+  Extents_Write done;
+
+  try {
+    // allocate
+    // continue right after the end of file
+    int32_t goal = extents.empty()
+                       ? -1
+                       : extents.back().start + extents.back().length;
+    new_data = cluster_alloc(need - have, goal);
+    if (new_data.empty()) {
+      throw jkfilesystem_error("Cannot allocate more clusters for data...");
+    }
+
+    for (const auto &cluster : new_data) {
+      if (!extents.empty() &&
+          extents.back().start + extents.back().length == cluster) {
+        extents.back().length++;
+      } else {
+        extents.push_back({cluster, 1});
+      }
+    }
+
+    file_extents__write(inode, extents, nodes, new_data.back() + 1, done);
+
+    // write inode back to fs
+    inode.file_size = new_size;
+    inode_write(inode_id, inode);
+
+    Block_Map map{{}, done.nodes};
+    for (const auto &e : extents) {
+      for (int32_t i = 0; i < e.length; i++) {
+        map.data.push_back(e.start + i);
+      }
+    }
+    file_block_map(inode_id, std::move(map));
+  } catch (...) {
+    block_maps_.erase(inode_id);
+
+    // reverse all the actions to be in the before state
+    file_extents__undo(done);
+    for (const auto &cluster : new_data) {
+      cluster_free(cluster);
+    }
+
+    throw;
+  }
+
+  for (const auto &cluster : placeholder) {
+    cluster_free(cluster);
+  }
+}
+
+void Filesystem::file_extents__write(struct inode &inode,
+                                     const std::vector<struct extent> &extents,
+                                     const std::vector<int32_t> &nodes,
+                                     int32_t goal, Extents_Write &done) {
+  // extents which don't fit inside inode go to nodes
+  size_t outside =
+      extents.size() > inode::EXTENTS ? extents.size() - inode::EXTENTS : 0;
+  size_t per_node = file_extents_in_node();
+  size_t need_nodes = (outside + per_node - 1) / per_node;
+  if (need_nodes > nodes.size()) {
+    done.new_nodes = cluster_alloc(need_nodes - nodes.size(), goal);
+    if (done.new_nodes.empty()) {
+      throw jkfilesystem_error("Cannot allocate more clusters for overhead.");
+    }
+  }
+  auto keep = static_cast<ptrdiff_t>(std::min(nodes.size(), need_nodes));
+  done.nodes.assign(nodes.begin(), nodes.begin() + keep);
+  done.nodes.insert(done.nodes.end(), done.new_nodes.begin(),
+                    done.new_nodes.end());
+  done.unused.assign(nodes.begin() + keep, nodes.end());
+
+  // write nodes
+  for (size_t n = 0; n < need_nodes; n++) {
+    auto first = inode::EXTENTS + n * per_node;
+    auto count = std::min(per_node, extents.size() - first);
+    struct extent_node header{
+        static_cast<int32_t>(count),
+        n + 1 < need_nodes ? done.nodes[n + 1] : 0,
+    };
+
+    std::vector<char> raw(sizeof(header) + count * sizeof(struct extent));
+    std::memcpy(raw.data(), &header, sizeof(header));
+    std::memcpy(raw.data() + sizeof(header), &extents[first],
+                count * sizeof(struct extent));
+
+    if (n < nodes.size()) {
+      done.backup.emplace_back(done.nodes[n], cluster_read(done.nodes[n]));
+    }
+    cluster_write(done.nodes[n], raw.data(), static_cast<int32_t>(raw.size()));
+  }
+
+  // inode only in memory
+  for (size_t i = 0; i < inode::EXTENTS; i++) {
+    inode.extent(i, i < extents.size() ? extents[i] : extent{});
+  }
+  inode.indirect2 = need_nodes > 0 ? done.nodes[0] : 0;
+}
+
+void Filesystem::file_extents__undo(const Extents_Write &done) {
+  for (const auto &[cluster, raw] : done.backup) {
+    cluster_write(cluster, reinterpret_cast<const char *>(raw.data()),
+                  static_cast<int32_t>(raw.size()));
+  }
+  for (const auto &cluster : done.new_nodes) {
+    cluster_free(cluster);
+  }
+}
+
+void Filesystem::file_unshare(int32_t inode_id, size_t offset, size_t size) {
+  if (size == 0 || refcounts_.shared() == 0) {
+    return; // nothing is shared anywhere
+  }
+
+  auto cs = static_cast<size_t>(cluster_size_);
+  size_t first = offset / cs;
+  auto range =
+      file_map_range(inode_id, first, (offset + size - 1) / cs - first + 1);
+  std::vector<size_t> shared; // positions of shared clusters in file
+  for (size_t i = 0; i < range.size(); i++) {
+    if (refcounts_.get(static_cast<size_t>(range[i])) > 0) {
+      shared.push_back(first + i);
+    }
+  }
+  if (shared.empty()) {
+    return;
+  }
+
+  auto map = file_list_clusters(inode_id);
+  auto data = std::get<0>(map);
+  auto inode = inode_read(inode_id);
+
+  std::vector<int32_t> copies;
+  std::vector<int32_t> originals;
+  Extents_Write done;
+  try {
+    copies = cluster_alloc(shared.size(),
+                           shared[0] > 0 ? data[shared[0] - 1] + 1 : -1);
+    if (copies.empty()) {
+      throw jkfilesystem_error("Not enough space.");
+    }
+
+    for (size_t j = 0; j < shared.size(); j++) {
+      auto pos = shared[j];
+      // whole cluster is about to be overwritten, the copy reads as zeros
+      // until then
+      bool whole = pos * cs >= offset && (pos + 1) * cs <= offset + size;
+      if (!whole) {
+        auto content = cluster_view(data[pos]);
+        cluster_put(copies[j], {content.begin(), content.end()});
+      }
+      originals.push_back(data[pos]);
+      data[pos] = copies[j];
+    }
+
+    std::vector<struct extent> extents;
+    for (const auto &cluster : data) {
+      if (!extents.empty() &&
+          extents.back().start + extents.back().length == cluster) {
+        extents.back().length++;
+      } else {
+        extents.push_back({cluster, 1});
+      }
+    }
+
+    file_extents__write(inode, extents, std::get<1>(map), copies.back() + 1,
+                        done);
+    inode_write(inode_id, inode);
+  } catch (...) {
+    block_maps_.erase(inode_id);
+    file_extents__undo(done);
+    for (const auto &cluster : copies) {
+      cluster_free(cluster);
+    }
+
+    throw;
+  }
+
+  file_block_map(inode_id, {data, done.nodes});
+  for (const auto &cluster : done.unused) {
+    cluster_free(cluster);
+  }
+  // only drops reference of this file
+  for (const auto &cluster : originals) {
+    cluster_free(cluster);
+  }
+}
+
+bool Filesystem::file_ensure_size__drop_placeholder(int32_t cluster,
+                                                    size_t count) {
+  auto after = static_cast<size_t>(cluster) + 1;
+  bool extendable =
+      bitmapd_.find_run(count - 1, after) == static_cast<int64_t>(after);
+  return !extendable && bitmapd_.find_run(count) >= 0;
+}
+
 std::vector<int32_t>
 Filesystem::file_ensure_size__join(std::vector<int32_t> &first,
                                    std::vector<int32_t> &second) {
@@ -435,116 +1105,153 @@ Filesystem::file_ensure_size__join(std::vector<int32_t> &first,
   return result;
 }
 
-void Filesystem::file_ensure_size__write_overhead_clusters(
-    struct inode &inode, std::vector<int32_t> &clusters) {
-  auto idx = 0;
-  struct inode backup_inode;
-  backup_inode.copy_from(inode);
-  std::vector<uint8_t> backup_indirect2;
-  bool failed_in_indirect2 = false;
-
-  try {
-    // indirect 1
-    if (idx >= clusters.size()) {
-      return;
+std::vector<Slot_Patch> Filesystem::file_ensure_size__append(
+    struct inode &inode, const std::vector<int32_t> &data, size_t have_data,
+    const std::vector<int32_t> &overhead, size_t have_overhead) {
+  std::vector<Slot_Patch> patches;
+  // neighbouring slots of the same cluster are written at once
+  auto assign = [&patches](int32_t cluster, size_t slot, int32_t value) {
+    if (!patches.empty() && patches.back().cluster == cluster &&
+        patches.back().first + patches.back().values.size() == slot) {
+      patches.back().values.push_back(value);
+    } else {
+      patches.push_back({cluster, slot, {value}});
     }
-    inode.indirect1 = clusters[idx++];
-
-    // indirect 2
-    if (idx >= clusters.size()) {
-      return;
+  };
+  const size_t direct = std::size(inode.direct);
+  const size_t in_cluster = cluster_size_ / sizeof(int32_t);
+
+  // overhead: indirect1, indirect2, then indirect1s listed in indirect2
+  for (size_t i = have_overhead; i < overhead.size(); i++) {
+    if (i == 0) {
+      inode.indirect1 = overhead[i];
+    } else if (i == 1) {
+      inode.indirect2 = overhead[i];
+    } else {
+      assign(overhead[1], i - 2, overhead[i]);
     }
-    inode.indirect2 = clusters[idx++];
+  }
 
-    // can fit inside ind2 ?
-    auto overhead_left = clusters.size() - idx;
-    auto max_ind1_in_ind2 = cluster_size_ / sizeof(clusters[0]);
-    if (overhead_left < 0 || overhead_left > max_ind1_in_ind2) {
-      throw jkfilesystem_error(
-          "Cannot fit indirect1s inside indirect2 - file too big");
+  // data: directs, indirect1, then indirect1s listed in indirect2
+  for (size_t i = have_data; i < data.size(); i++) {
+    if (i < direct) {
+      inode.direct[i] = data[i];
+      continue;
     }
+    size_t slot = i - direct;
+    if (slot < in_cluster) {
+      assign(overhead.at(0), slot, data[i]);
+      continue;
+    }
+    slot -= in_cluster;
+    assign(overhead.at(2 + slot / in_cluster), slot % in_cluster, data[i]);
+  }
 
-    // write all ind1 to ind2
-    backup_indirect2 = cluster_read(inode.indirect2);
-    failed_in_indirect2 = true;
-    cluster_write(inode.indirect2,
-                  reinterpret_cast<const char *>(&clusters[idx]),
-                  overhead_left * sizeof(clusters[0]));
+  size_t written = 0;
+  try {
+    for (; written < patches.size(); written++) {
+      const auto &patch = patches[written];
+      file_write__slots(patch.cluster, patch.first, patch.values);
+    }
   } catch (...) {
-    if (failed_in_indirect2) {
-      // restore indirect2 cluster
-      cluster_write(inode.indirect2,
-                    reinterpret_cast<const char *>(backup_indirect2.data()),
-                    backup_indirect2.size() * sizeof(backup_indirect2[0]));
+    // empty the slots again
+    for (size_t i = 0; i < written; i++) {
+      file_write__slots(patches[i].cluster, patches[i].first,
+                        std::vector<int32_t>(patches[i].values.size(), 0));
     }
 
-    // restore inode
-    inode.copy_from(backup_inode);
-
     throw;
   }
-}
 
-void Filesystem::file_ensure_size__write_clusters_data(
-    struct inode &inode, std::vector<int32_t> &data,
-    const std::vector<int32_t> &overhead) {
-  auto idx = 0;
-  auto overhead_idx = 0;
-  struct inode backup_inode;
-  backup_inode.copy_from(inode);
-  // vector of [cluster idx, raw indirect1 file]
-  std::vector<std::pair<size_t, std::vector<uint8_t>>> backup_indirect_1s;
+  return patches;
+}
 
-  try {
-    // direct
-    for (auto i = 0; i < std::size(inode.direct); i++) {
-      if (idx >= data.size()) {
-        return; // work already done
-      }
-      inode.direct[i] = data[idx++];
+void Filesystem::file_read__runs(
+    int32_t inode_id, size_t offset, size_t length,
+    const std::function<void(size_t, size_t)> &on_device,
+    const Chunk_Reader &in_memory) {
+  auto file_size =
+      static_cast<size_t>(std::max(inode_read(inode_id).file_size, 0));
+  if (offset >= file_size || length == 0) {
+    return;
+  }
+  length = std::min(length, file_size - offset);
+
+  auto cs = static_cast<size_t>(cluster_size_);
+  size_t first = offset / cs;
+  auto clusters =
+      file_map_range(inode_id, first, (offset + length - 1) / cs - first + 1);
+
+  auto sb = superblock();
+  size_t pos = offset; // next byte of file to pass
+  size_t end = std::min(offset + length, (first + clusters.size()) * cs);
+
+  size_t i = 0;
+  while (i < clusters.size()) {
+    auto cluster = clusters[i];
+    size_t run_start = (first + i) * cs; // file position of the run
+
+    if (!cluster_on_device(cluster)) {
+      // zeros or newer content in cache
+      auto data = cluster_view(cluster);
+      size_t to = std::min(end - run_start, cs);
+      in_memory(data.subspan(pos - run_start, to - (pos - run_start)));
+      pos = run_start + to;
+      i++;
+      continue;
     }
 
-    // indirect 1
-    auto max_data_in_ind1 = cluster_size_ / sizeof(data[0]);
-    auto amount_to_ind1 = std::min(max_data_in_ind1, data.size() - idx);
-
-    backup_indirect_1s.push_back(
-        {overhead[overhead_idx], cluster_read(overhead[overhead_idx])});
-    cluster_write(overhead[overhead_idx],
-                  reinterpret_cast<const char *>(&data[idx]),
-                  amount_to_ind1 * sizeof(data[idx]));
-    overhead_idx++;
-    idx += amount_to_ind1;
-
-    // indirect 2
-    overhead_idx++; // skip indirect2
-    while (idx < data.size() && overhead_idx < overhead.size()) {
-      auto ind1 = overhead[overhead_idx];
-
-      // overwrite indirect 1
-      amount_to_ind1 = std::min(max_data_in_ind1, data.size() - idx);
-      backup_indirect_1s.push_back({ind1, cluster_read(ind1)});
-
-      cluster_write(ind1, reinterpret_cast<const char *>(&data[idx]),
-                    amount_to_ind1 * sizeof(data[idx]));
-
-      // go to next
-      overhead_idx++;
-      idx += amount_to_ind1;
+    // neighbours on device are passed at once
+    size_t n = 1;
+    while (i + n < clusters.size() && n < run_max_ &&
+           clusters[i + n] == cluster + static_cast<int32_t>(n) &&
+           cluster_on_device(clusters[i + n])) {
+      n++;
     }
 
-  } catch (...) {
-    // restore inode
-    inode.copy_from(backup_inode);
+    size_t to = std::min(end, run_start + n * cs);
+    on_device(static_cast<size_t>(sb.data_start_addr) +
+                  static_cast<size_t>(cluster) * cs + (pos - run_start),
+              to - pos);
+    pos = to;
+    i += n;
+  }
+}
 
-    // restore all overwritten indirect 1 clusters
-    for (const auto &[idx, raw] : backup_indirect_1s) {
-      cluster_write(idx, reinterpret_cast<const char *>(raw.data()),
-                    raw.size() * sizeof(raw[0]));
+void Filesystem::fd_write(int fd, size_t offset,
+                          std::span<const uint8_t> data) {
+  while (!data.empty()) {
+    auto n = ::pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR) {
+      continue;
     }
+    if (n <= 0) {
+      throw jkfilesystem_error(std::string("Cannot write into host file: ") +
+                               std::strerror(errno));
+    }
+    data = data.subspan(static_cast<size_t>(n));
+    offset += static_cast<size_t>(n);
+  }
+}
 
-    throw;
+size_t Filesystem::fd_read(int fd, size_t offset, std::span<uint8_t> data) {
+  size_t read = 0;
+  while (read < data.size()) {
+    auto n = ::pread(fd, data.data() + read, data.size() - read,
+                     static_cast<off_t>(offset + read));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      throw jkfilesystem_error(std::string("Cannot read from host file: ") +
+                               std::strerror(errno));
+    }
+    if (n == 0) {
+      break; // end of file
+    }
+    read += static_cast<size_t>(n);
   }
+  return read;
 }
 
 } // namespace jkfs
@@ -13,15 +13,6 @@ namespace jkfs {
 
 // === METHODS ===
 
-void Filesystem::filesystem_ensure() {
-  if (!std::filesystem::exists(path_)) {
-    file_.close();
-    std::ofstream o(path_);
-    o.close();
-    path(path_);
-  }
-}
-
 void Filesystem::filesystem_resize(size_t size) {
   if (size < min_size_) {
     throw jkfilesystem_error("The size is too small. Min size: " +
@@ -34,11 +25,10 @@ void Filesystem::filesystem_resize(size_t size) {
   // if this fails, rather fail before resizing
   auto sb = sb_from_size(static_cast<int32_t>(size));
 
-  filesystem_ensure();
-
-  file_.close();
-  std::filesystem::resize_file(path_, static_cast<uintmax_t>(size));
-  path(path_);
+  // everything loaded from the old layout is invalid now
+  cache_.clear();
+  unmount();
+  device_->resize(size);
 
   superblock(sb);
 
@@ -78,12 +68,15 @@ int32_t Filesystem::iterative_count_max(int32_t available_space,
 int32_t Filesystem::count_clusters(int32_t effective_size) const {
   int size = static_cast<int>(std::floor(effective_size * (1 - id_ratio_)));
 
-  return std::max(2, iterative_count_max(size, cluster_size_));
+  // refcount entry is counted as part of its cluster
+  return std::max(2, iterative_count_max(size, cluster_size_ +
+                                                   refcount_entry_size()));
 }
 
 int32_t Filesystem::count_inodes(int32_t effective_size,
                                  int32_t cluster_count) const {
-  int size = effective_size - cluster_size_ * cluster_count -
+  int size = effective_size -
+             (cluster_size_ + refcount_entry_size()) * cluster_count -
              static_cast<int>(std::ceil(0.125 * cluster_count));
 
   return iterative_count_max(size, sizeof(struct inode));
@@ -95,11 +88,15 @@ void Filesystem::print_usage_info(struct superblock &sb) const {
   std::cout << "Used space of file: \n"
             << "Total: " << std::to_string(position / ts * 100.) << "%\n"
             << "Superblock: "
-            << std::to_string(sizeof(struct superblock) / ts * 100.) << "%\n"
+            << std::to_string(sb.stored_size() / ts * 100.) << "%\n"
             << "Bitmap - inodes: "
             << std::to_string(sb.bitmapi_size / ts * 100.) << "%\n"
             << "Bitmap - clusters: "
             << std::to_string(sb.bitmapd_size / ts * 100.) << "%\n"
+            << (sb.refcount_size > 0
+                    ? "Refcounts: " +
+                          std::to_string(sb.refcount_size / ts * 100.) + "%\n"
+                    : "")
             << "Inodes: "
             << std::to_string(sb.inode_count * sb.inode_size / ts * 100.)
             << "%\n"
@@ -112,17 +109,19 @@ void Filesystem::print_usage_info(struct superblock &sb) const {
 
 struct superblock Filesystem::sb_from_size(int32_t total_size) const {
   struct superblock sb{};
+  std::copy_n(SIGNATURE.data(), SIGNATURE.size(), sb.signature);
+  sb.version = format_version_;
+
   // effective size which can be used to store everything except superblock
-  int32_t size = total_size - static_cast<int32_t>(sizeof(struct superblock));
+  int32_t size = total_size - static_cast<int32_t>(sb.stored_size());
 
-  std::copy_n("javok", 5, sb.signature);
   sb.disk_size = total_size;
   sb.cluster_size = cluster_size_;
   sb.inode_size = static_cast<int32_t>(sizeof(struct inode));
   sb.cluster_count = count_clusters(size);
   sb.inode_count = count_inodes(size, sb.cluster_count);
 
-  int32_t position = sizeof(struct superblock);
+  int32_t position = static_cast<int32_t>(sb.stored_size());
 
   sb.bitmapi_start_addr = position;
   position +=
@@ -132,6 +131,12 @@ struct superblock Filesystem::sb_from_size(int32_t total_size) const {
   position += static_cast<int32_t>(
       std::ceil(static_cast<float>(sb.cluster_count) / 8.f));
 
+  if (refcount_entry_size() > 0) {
+    sb.refcount_start_addr = position;
+    sb.refcount_size = sb.cluster_count * refcount_entry_size();
+    position += sb.refcount_size;
+  }
+
   sb.inode_start_addr = position;
   position += sb.inode_count * sb.inode_size;
 
@@ -139,7 +144,9 @@ struct superblock Filesystem::sb_from_size(int32_t total_size) const {
   position += sb.cluster_count * sb.cluster_size;
 
   sb.bitmapi_size = sb.bitmapd_start_addr - sb.bitmapi_start_addr;
-  sb.bitmapd_size = sb.inode_start_addr - sb.bitmapd_start_addr;
+  sb.bitmapd_size = (sb.refcount_size > 0 ? sb.refcount_start_addr
+                                          : sb.inode_start_addr) -
+                    sb.bitmapd_start_addr;
 
   if (vocal_) {
     std::cout << sb << std::endl;
@@ -166,6 +173,23 @@ void Filesystem::clear_bitmaps(const struct superblock &sb) {
   zeros.assign(static_cast<size_t>(sb.bitmapd_size), 0);
   write_bytes(reinterpret_cast<const char *>(zeros.data()), sb.bitmapd_size,
               sb.bitmapd_start_addr);
+
+  zeros.assign(static_cast<size_t>(sb.refcount_size), 0);
+  write_bytes(reinterpret_cast<const char *>(zeros.data()), sb.refcount_size,
+              sb.refcount_start_addr);
+
+  bitmapi_.reset(static_cast<size_t>(sb.inode_count),
+                 static_cast<size_t>(sb.bitmapi_size));
+  bitmapd_.reset(static_cast<size_t>(sb.cluster_count),
+                 static_cast<size_t>(sb.bitmapd_size));
+  refcounts_.reset(sb.refcount_size > 0 ? static_cast<size_t>(sb.cluster_count)
+                                        : 0);
+}
+
+int32_t Filesystem::refcount_entry_size() const {
+  return format_version_ >= superblock::VERSION_REFLINK
+             ? static_cast<int32_t>(RefcountTable::ENTRY_SIZE)
+             : 0;
 }
 
 } // namespace jkfs
@@ -1,6 +1,11 @@
 #include "errors.hpp"
 #include "filesystem.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
 #include <string>
+#include <vector>
 
 namespace jkfs {
 
@@ -26,16 +31,64 @@ struct inode Filesystem::inode_read(int32_t id) {
   return read<struct inode>(position);
 }
 
-int32_t Filesystem::inode_alloc() {
+std::vector<struct inode>
+Filesystem::inode_read_many(std::span<const int32_t> ids) {
+  for (const auto id : ids) {
+    if (inode_is_empty(id)) { // also checks the range
+      throw jkfilesystem_error("Inode with id=" + std::to_string(id) +
+                               " is not used.");
+    }
+  }
   auto sb = superblock();
-  auto buf =
-      read_bytes(static_cast<size_t>(sb.bitmapi_size), sb.bitmapi_start_addr);
+  auto stride = static_cast<size_t>(sb.inode_size);
+
+  // every inode once, in order of the inode table
+  std::vector<int32_t> sorted(ids.begin(), ids.end());
+  std::ranges::sort(sorted);
+  auto [last, end] = std::ranges::unique(sorted);
+  sorted.erase(last, end);
+
+  std::vector<struct inode> table(sorted.size());
+  std::vector<uint8_t> buffer;
+  for (size_t first = 0, next = 0; first < sorted.size(); first = next) {
+    // extend the range over small gaps until it is too long
+    auto base = static_cast<size_t>(sorted[first]);
+    for (next = first + 1; next < sorted.size(); next++) {
+      auto gap = static_cast<size_t>(sorted[next] - sorted[next - 1] - 1);
+      auto length = static_cast<size_t>(sorted[next]) - base + 1;
+      if (gap * stride > INODE_READ_GAP || length * stride > INODE_READ_MAX) {
+        break;
+      }
+    }
+
+    auto length = static_cast<size_t>(sorted[next - 1]) - base + 1;
+    buffer.resize((length - 1) * stride + sizeof(struct inode));
+    device_->read(sb.inode_start_addr + base * stride, buffer.data(),
+                  buffer.size());
+    for (auto i = first; i < next; i++) {
+      auto at = (static_cast<size_t>(sorted[i]) - base) * stride;
+      std::memcpy(&table[i], buffer.data() + at, sizeof(struct inode));
+    }
+  }
+
+  std::vector<struct inode> inodes;
+  inodes.reserve(ids.size());
+  for (const auto id : ids) {
+    auto it = std::ranges::lower_bound(sorted, id);
+    inodes.push_back(table[static_cast<size_t>(it - sorted.begin())]);
+  }
+  return inodes;
+}
+
+int32_t Filesystem::inode_alloc() {
+  superblock(); // ensure bitmaps are loaded
 
   // find empty
-  auto idx = get_first_bit(buf, 0);
+  auto idx = static_cast<int32_t>(bitmapi_.find_next_free());
   if (idx < 0) {
     return -1;
   }
+  bitmapi_.cursor(static_cast<size_t>(idx) + 1);
 
   // mark as used & clear
   inode_write(idx, inode{});
@@ -56,13 +109,7 @@ bool Filesystem::inode_is_empty(int32_t id) {
                              ">, but you tried " + std::to_string(id));
   }
 
-  int byte_idx = id / 8;
-  int bit_idx = id % 8;
-
-  auto byte = read<uint8_t>(sb.bitmapi_start_addr + byte_idx);
-
-  auto used = bit_get(byte, static_cast<unsigned int>(bit_idx));
-  return !used;
+  return !bitmapi_.get(static_cast<size_t>(id));
 }
 
 void Filesystem::inode_write(int32_t id, const struct inode &i) {
@@ -79,12 +126,7 @@ void Filesystem::inode_write(int32_t id, const struct inode &i) {
   }
 
   // bitmap
-  int byte_idx = id / 8;
-  int bit_idx = id % 8;
-
-  uint8_t byte = read<uint8_t>(sb.bitmapi_start_addr + byte_idx);
-  bit_set(byte, static_cast<unsigned int>(bit_idx)); // mark as used
-  write(byte, sb.bitmapi_start_addr + byte_idx);
+  bitmap_mark(bitmapi_, id, true); // mark as used
 
   // inode
   write(i, sb.inode_start_addr + sb.inode_size * id);
@@ -104,12 +146,11 @@ void Filesystem::inode_free(int32_t id) {
   }
 
   // bitmap
-  int byte_idx = id / 8;
-  int bit_idx = id % 8;
-
-  uint8_t byte = read<uint8_t>(sb.bitmapi_start_addr + byte_idx);
-  bit_clear(byte, static_cast<unsigned int>(bit_idx)); // mark as unused
-  write(byte, sb.bitmapi_start_addr + byte_idx);
+  bitmap_mark(bitmapi_, id, false); // mark as unused
+  block_maps_.erase(id);
+  // the inode may come back as a different directory
+  dentries_.erase_parent(id);
+  dir_holes_.erase(id);
 }
 
 } // namespace jkfs
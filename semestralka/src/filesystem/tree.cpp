@@ -0,0 +1,308 @@
+#include "errors.hpp"
+#include "filesystem.hpp"
+#include "structures.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace jkfs {
+
+namespace {
+
+// child of inner node where <name> belongs - the last one whose name is
+// <= <name>, name of the first child is never compared
+size_t tree_child(const std::vector<dir_item> &slots, int32_t count,
+                  std::string_view name) {
+  auto first = slots.begin() + 1;
+  auto it = std::upper_bound(
+      first + 1, first + count, name,
+      [](std::string_view n, const dir_item &item) { return n < item.name(); });
+  return static_cast<size_t>(it - first) - 1;
+}
+
+// position of the first item of leaf whose name is >= <name>
+size_t tree_lower(const std::vector<dir_item> &slots, int32_t count,
+                  std::string_view name) {
+  auto first = slots.begin() + 1;
+  auto it = std::lower_bound(
+      first, first + count, name,
+      [](const dir_item &item, std::string_view n) { return item.name() < n; });
+  return static_cast<size_t>(it - first);
+}
+
+} // namespace
+
+void Filesystem::dir_tree__write(int32_t id, const struct dir_tree &tree) {
+  dir_item_write(id, 0, std::bit_cast<dir_item>(tree));
+}
+
+std::vector<dir_item> Filesystem::dir_tree__node(int32_t id, int32_t node) {
+  auto size = static_cast<size_t>(cluster_size_);
+  std::vector<dir_item> slots(size / sizeof(dir_item));
+
+  auto read = file_read(id, static_cast<size_t>(node) * size,
+                        {reinterpret_cast<uint8_t *>(slots.data()), size});
+  auto head = std::bit_cast<dir_node>(slots[0]);
+  if (node <= 0 || read < size || head.no_name != '\0' || head.count < 0 ||
+      static_cast<size_t>(head.count) >= slots.size()) {
+    throw jkfilesystem_error("Directory tree is corrupted.");
+  }
+  return slots;
+}
+
+void Filesystem::dir_tree__store(int32_t id, int32_t node,
+                                 const std::vector<dir_item> &slots) {
+  file_write__range(id, node * cluster_size_,
+                    reinterpret_cast<const char *>(slots.data()),
+                    slots.size() * sizeof(dir_item));
+}
+
+std::tuple<std::vector<int32_t>, std::vector<dir_item>>
+Filesystem::dir_tree__path(int32_t id, const struct dir_tree &tree,
+                           std::string_view name) {
+  std::vector<int32_t> path{tree.root};
+  // deeper than this would need more nodes than any directory can have
+  constexpr size_t DEPTH_MAX = 32;
+
+  while (path.size() <= DEPTH_MAX) {
+    auto slots = dir_tree__node(id, path.back());
+    auto head = std::bit_cast<dir_node>(slots[0]);
+    if (head.leaf) {
+      return {path, slots};
+    }
+    if (head.count <= 0) {
+      break;
+    }
+    path.push_back(slots[1 + tree_child(slots, head.count, name)].inode);
+  }
+  throw jkfilesystem_error("Directory tree is corrupted.");
+}
+
+std::tuple<int32_t, int32_t>
+Filesystem::dir_tree__find(int32_t id, const struct dir_tree &tree,
+                           const std::string &name) {
+  auto [path, slots] = dir_tree__path(id, tree, name);
+  auto count = std::bit_cast<dir_node>(slots[0]).count;
+
+  auto pos = tree_lower(slots, count, name);
+  if (pos < static_cast<size_t>(count) && slots[1 + pos].name_matches(name)) {
+    auto offset = static_cast<size_t>(path.back()) * cluster_size_ +
+                  (1 + pos) * sizeof(dir_item);
+    return {static_cast<int32_t>(offset), slots[1 + pos].inode};
+  }
+  return {-1, -1};
+}
+
+void Filesystem::dir_tree__add(int32_t id, struct dir_tree tree,
+                               const dir_item &item) {
+  auto [path, leaf] = dir_tree__path(id, tree, item.name());
+  auto capacity = static_cast<int32_t>(leaf.size()) - 1;
+
+  // nodes which get the new item (or separator), from leaf up; all but
+  // the last one are full & split
+  std::vector<std::vector<dir_item>> levels{std::move(leaf)};
+  while (std::bit_cast<dir_node>(levels.back()[0]).count >= capacity &&
+         levels.size() < path.size()) {
+    levels.push_back(dir_tree__node(id, path[path.size() - 1 - levels.size()]));
+  }
+  auto splits = levels.size() - 1;
+  if (std::bit_cast<dir_node>(levels.back()[0]).count >= capacity) {
+    splits += 2; // root splits & new root above it
+  }
+
+  // allocate all new nodes first, so nothing changes if there isn't space
+  auto size = inode_read(id).file_size;
+  auto next_node = size / cluster_size_;
+  if (splits > 0) {
+    if (static_cast<int64_t>(size) +
+            static_cast<int64_t>(splits) * cluster_size_ >
+        std::numeric_limits<int32_t>::max()) {
+      throw jkfilesystem_error("Directory cannot hold any more items.");
+    }
+    file_ensure_size(id, size + static_cast<int32_t>(splits) * cluster_size_);
+  }
+
+  auto carry = item;
+  for (size_t level = 0;; level++) {
+    auto &slots = levels[level];
+    auto head = std::bit_cast<dir_node>(slots[0]);
+    auto node = path[path.size() - 1 - level];
+
+    // separator goes right after the child which was split
+    auto pos = head.leaf ? tree_lower(slots, head.count, carry.name())
+                         : tree_child(slots, head.count, carry.name()) + 1;
+    std::vector<dir_item> items(slots.begin() + 1,
+                                slots.begin() + 1 + head.count);
+    items.insert(items.begin() + static_cast<ptrdiff_t>(pos), carry);
+
+    if (static_cast<int32_t>(items.size()) <= capacity) {
+      std::ranges::copy(items, slots.begin() + 1);
+      head.count = static_cast<int32_t>(items.size());
+      slots[0] = std::bit_cast<dir_item>(head);
+      dir_tree__store(id, node, slots);
+      break;
+    }
+
+    // split in half, the right half goes into a new node
+    auto half = items.size() / 2;
+    auto right = next_node++;
+    std::vector<dir_item> right_slots(slots.size(), dir_item{});
+    struct dir_node right_head{};
+    right_head.leaf = head.leaf;
+    right_head.next = head.leaf ? head.next : 0;
+    right_head.count = static_cast<int32_t>(items.size() - half);
+    right_slots[0] = std::bit_cast<dir_item>(right_head);
+    std::copy(items.begin() + static_cast<ptrdiff_t>(half), items.end(),
+              right_slots.begin() + 1);
+
+    std::ranges::fill(slots, dir_item{});
+    head.next = head.leaf ? right : 0;
+    head.count = static_cast<int32_t>(half);
+    slots[0] = std::bit_cast<dir_item>(head);
+    std::copy(items.begin(), items.begin() + static_cast<ptrdiff_t>(half),
+              slots.begin() + 1);
+
+    dir_tree__store(id, node, slots);
+    dir_tree__store(id, right, right_slots);
+
+    carry = items[half];
+    carry.inode = right;
+
+    if (level + 1 == path.size()) {
+      // root was split, the tree grows by one level
+      auto root = next_node++;
+      std::vector<dir_item> root_slots(slots.size(), dir_item{});
+      struct dir_node root_head{};
+      root_head.count = 2;
+      root_slots[0] = std::bit_cast<dir_item>(root_head);
+      root_slots[1] = items[0];
+      root_slots[1].inode = node;
+      root_slots[2] = carry;
+      dir_tree__store(id, root, root_slots);
+      tree.root = root;
+      break;
+    }
+  }
+
+  tree.items++;
+  dir_tree__write(id, tree);
+}
+
+void Filesystem::dir_tree__erase(int32_t id, struct dir_tree tree,
+                                 int32_t offset) {
+  auto node = offset / cluster_size_;
+  auto slot = static_cast<size_t>(offset % cluster_size_) / sizeof(dir_item);
+
+  auto slots = dir_tree__node(id, node);
+  auto head = std::bit_cast<dir_node>(slots[0]);
+  if (slot == 0 || slot > static_cast<size_t>(head.count)) {
+    throw jkfilesystem_error("Directory item is out of the directory.");
+  }
+
+  // items after it move one slot back, so the leaf stays ordered
+  std::copy(slots.begin() + static_cast<ptrdiff_t>(slot) + 1,
+            slots.begin() + 1 + head.count,
+            slots.begin() + static_cast<ptrdiff_t>(slot));
+  slots[static_cast<size_t>(head.count)] = dir_item{};
+  head.count--;
+  slots[0] = std::bit_cast<dir_item>(head);
+  dir_tree__store(id, node, slots);
+
+  tree.items--;
+  dir_tree__write(id, tree);
+}
+
+void Filesystem::dir_tree__build(int32_t id, std::vector<dir_item> items) {
+  std::sort(items.begin(), items.end());
+
+  auto slots = static_cast<size_t>(cluster_size_) / sizeof(dir_item);
+  // room for items added later before the first split
+  auto fill = (slots - 1) * 3 / 4;
+
+  // header & its unused cluster, then nodes
+  std::vector<dir_item> data(slots, dir_item{});
+  int32_t nodes = 0;
+
+  // put <entries> into nodes of one level, return entries of level above
+  auto put_level = [&](const std::vector<dir_item> &entries, bool leaf) {
+    std::vector<dir_item> parents;
+    auto count = std::max<size_t>(1, (entries.size() + fill - 1) / fill);
+    for (size_t n = 0; n < count; n++) {
+      // spread evenly, so no node is almost empty
+      auto from = entries.size() * n / count;
+      auto to = entries.size() * (n + 1) / count;
+      auto node = ++nodes;
+      data.resize((static_cast<size_t>(node) + 1) * slots, dir_item{});
+
+      struct dir_node head{};
+      head.leaf = leaf;
+      head.next = leaf && n + 1 < count ? node + 1 : 0;
+      head.count = static_cast<int32_t>(to - from);
+      auto first = static_cast<size_t>(node) * slots;
+      data[first] = std::bit_cast<dir_item>(head);
+      std::copy(entries.begin() + static_cast<ptrdiff_t>(from),
+                entries.begin() + static_cast<ptrdiff_t>(to),
+                data.begin() + static_cast<ptrdiff_t>(first) + 1);
+
+      auto parent = from < to ? entries[from] : dir_item{};
+      parent.inode = node;
+      parents.push_back(parent);
+    }
+    return parents;
+  };
+
+  auto level = put_level(items, true);
+  while (level.size() > 1) {
+    level = put_level(level, false);
+  }
+
+  if (data.size() * sizeof(dir_item) >
+      static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+    throw jkfilesystem_error("Directory cannot hold any more items.");
+  }
+
+  struct dir_tree tree{};
+  tree.root = level[0].inode;
+  tree.items = static_cast<int32_t>(items.size());
+  data[0] = std::bit_cast<dir_item>(tree);
+
+  // only enlarges, so it fails before anything is written
+  file_write(id, 0, reinterpret_cast<const char *>(data.data()),
+             data.size() * sizeof(dir_item));
+  dir_holes_.erase(id);
+}
+
+void Filesystem::dir_tree__scan(int32_t id, const struct dir_tree &tree,
+                                const std::string &prefix,
+                                const Item_Visitor &visitor) {
+  auto [path, slots] = dir_tree__path(id, tree, prefix);
+  auto pos = tree_lower(slots, std::bit_cast<dir_node>(slots[0]).count, prefix);
+
+  // leaves are chained in name order, a broken chain must not loop forever
+  auto leaves_max = inode_read(id).file_size / cluster_size_;
+  for (int32_t leaves = 0; leaves < leaves_max; leaves++) {
+    auto head = std::bit_cast<dir_node>(slots[0]);
+    for (auto i = pos; i < static_cast<size_t>(head.count); i++) {
+      // ordered, so no later name can start with prefix either
+      if (!slots[1 + i].name().starts_with(prefix) || !visitor(slots[1 + i])) {
+        return;
+      }
+    }
+    if (head.next == 0) {
+      return;
+    }
+    slots = dir_tree__node(id, head.next);
+    pos = 0;
+  }
+  throw jkfilesystem_error("Directory tree is corrupted.");
+}
+
+} // namespace jkfs
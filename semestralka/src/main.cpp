@@ -1,3 +1,6 @@
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
@@ -8,11 +11,24 @@
 #include <vector>
 
 #include "CommandManager.hpp"
+#include "IBlockDevice.hpp"
 #include "commands.hpp"
+#include "devices.hpp"
 
 using jkfs::Filesystem;
 
+bool get_flag(std::vector<std::string> args, const std::string &flag,
+              const std::string &long_flag);
 bool get_vocal(std::vector<std::string> args);
+std::string get_option(std::vector<std::string> args, const std::string &flag,
+                       const std::string &long_flag, const std::string &def);
+size_t get_count(std::vector<std::string> args, const std::string &flag,
+                 const std::string &long_flag, size_t def, size_t min,
+                 size_t max);
+std::unique_ptr<jkfs::IBlockDevice> get_device(std::vector<std::string> args,
+                                               const std::string &filename);
+jkfs::Durability get_durability(std::vector<std::string> args);
+int32_t get_format_version(std::vector<std::string> args);
 void setup_cmds(jkfs::CommandManager &manager);
 void terminal(jkfs::CommandManager &manager);
 
@@ -31,25 +47,141 @@ int main(int argc, char *argv[]) {
         args.at(0); // 0 because in args is one item less (no executable path)
   }
 
-  // setup fs filename & vocality
-  Filesystem::instance(filename).vocal(get_vocal(args));
+  // setup fs device & vocality
+  Filesystem::instance(get_device(args, filename)).vocal(get_vocal(args));
+  Filesystem::instance().cache().capacity(
+      get_count(args, "-c", "--cache", 256, 0, SIZE_MAX));
+  Filesystem::instance().durability(get_durability(args));
+  Filesystem::instance().secure_zero(get_flag(args, "-z", "--secure-zero"));
+  Filesystem::instance().format_version(get_format_version(args));
+  Filesystem::instance().stream_chunk(
+      get_count(args, "-s", "--stream-chunk", 4, 1, 1024) * 1024 * 1024);
 
   setup_cmds(manager);
 
   terminal(manager);
 
+  // nothing may stay only in memory
+  Filesystem::instance().sync();
+
   return EXIT_SUCCESS;
 }
 
-bool get_vocal(std::vector<std::string> args) {
+// Return true if the flag (e.g. "-v") is given.
+bool get_flag(std::vector<std::string> args, const std::string &flag,
+              const std::string &long_flag) {
   for (auto &arg : args) {
-    if (arg == "-v" || arg == "--vocal") {
+    if (arg == flag || arg == long_flag) {
       return true;
     }
   }
   return false;
 }
 
+bool get_vocal(std::vector<std::string> args) {
+  return get_flag(args, "-v", "--vocal");
+}
+
+// Return value following the flag (e.g. "-c 64"), or default if not given.
+std::string get_option(std::vector<std::string> args, const std::string &flag,
+                       const std::string &long_flag, const std::string &def) {
+  for (size_t i = 0; i + 1 < args.size(); i++) {
+    if (args[i] == flag || args[i] == long_flag) {
+      return args[i + 1];
+    }
+  }
+  return def;
+}
+
+// Return whole number following the flag, or default if not given. Anything
+// else than a number from <min> to <max> (e.g. "-c abc", "-c -1") is
+// reported and default is used instead.
+size_t get_count(std::vector<std::string> args, const std::string &flag,
+                 const std::string &long_flag, size_t def, size_t min,
+                 size_t max) {
+  auto option = get_option(args, flag, long_flag, std::to_string(def));
+
+  size_t count = 0;
+  const auto *end = option.data() + option.size();
+  auto [ptr, ec] = std::from_chars(option.data(), end, count);
+  if (ec != std::errc{} || ptr != end || count < min || count > max) {
+    std::cout << "Invalid value '" << option << "' of " << long_flag
+              << ", using " << def << "." << std::endl;
+    return def;
+  }
+  return count;
+}
+
+// Pick device by -d/--device <stream|pread|mmap|ram>, -m/--mmap is a shortcut
+// for mmap. Default is stream.
+std::unique_ptr<jkfs::IBlockDevice> get_device(std::vector<std::string> args,
+                                               const std::string &filename) {
+  std::string device = get_option(args, "-d", "--device", "stream");
+  for (auto &arg : args) {
+    if (arg == "-m" || arg == "--mmap") {
+      device = "mmap";
+    }
+  }
+
+  if (device == "pread") {
+    return std::make_unique<jkfs::PosixDevice>(filename);
+  }
+  if (device == "mmap") {
+    return std::make_unique<jkfs::MmapDevice>(filename);
+  }
+  if (device == "ram") {
+    return std::make_unique<jkfs::RamDevice>();
+  }
+  if (device != "stream") {
+    std::cout << "Unknown device '" << device << "', using stream."
+              << std::endl;
+  }
+  return std::make_unique<jkfs::StreamDevice>(filename);
+}
+
+// Pick durability by -D/--durability <always|batch|manual>. Default is batch.
+jkfs::Durability get_durability(std::vector<std::string> args) {
+  auto durability = get_option(args, "-D", "--durability", "batch");
+
+  if (durability == "always") {
+    return jkfs::Durability::ALWAYS;
+  }
+  if (durability == "manual") {
+    return jkfs::Durability::MANUAL;
+  }
+  if (durability != "batch") {
+    std::cout << "Unknown durability '" << durability << "', using batch."
+              << std::endl;
+  }
+  return jkfs::Durability::BATCH;
+}
+
+// Pick version used by format by -f/--format-version <1|2|3|4|5>. 1 is the
+// legacy direct/indirect layout, 2 uses extents, 3 also shares clusters,
+// default is 4 (big directories are hashed), 5 keeps big directories as
+// B+trees ordered by name instead.
+int32_t get_format_version(std::vector<std::string> args) {
+  auto version = get_option(args, "-f", "--format-version", "4");
+
+  if (version == "1") {
+    return jkfs::superblock::VERSION_LEGACY;
+  }
+  if (version == "2") {
+    return jkfs::superblock::VERSION_EXTENTS;
+  }
+  if (version == "3") {
+    return jkfs::superblock::VERSION_REFLINK;
+  }
+  if (version == "5") {
+    return jkfs::superblock::VERSION_DIR_TREE;
+  }
+  if (version != "4") {
+    std::cout << "Unknown format version '" << version << "', using 4."
+              << std::endl;
+  }
+  return jkfs::superblock::VERSION_DIR_INDEX;
+}
+
 // Register all commands to the Command Manager.
 // Set managers vocal level.
 void setup_cmds(jkfs::CommandManager &manager) {
@@ -74,6 +206,7 @@ void setup_cmds(jkfs::CommandManager &manager) {
   manager.register_command(std::make_unique<jkfs::AddCommand>());
   manager.register_command(std::make_unique<jkfs::HelpCommand>(manager));
   manager.register_command(std::make_unique<jkfs::ExecCommand>());
+  manager.register_command(std::make_unique<jkfs::SyncCommand>());
 }
 
 // Start and run the terminal.